@@ -0,0 +1,20 @@
+# replaying a recorded trace has to count the same faults, writes and reads
+# as running the program live, for every program, policy and frame count
+npages=100
+status=0
+counts() { grep -E "^Total (page faults|disk writes|disk reads):" | tr '\n' ' '; }
+for program in scan sort focus; do
+	./virtmem record $npages $program /tmp/check_replay.trc > /dev/null || exit 1
+	for alg in rand fifo custom lru 2q arc lirs clockpro; do
+		for nframes in 2 3 10 30 60; do
+			live=$(./virtmem $npages $nframes $alg $program | counts)
+			replay=$(./virtmem replay /tmp/check_replay.trc $nframes $alg | counts)
+			if [ "$live" != "$replay" ]; then
+				echo "$program $alg $nframes: live $live, replay $replay"
+				status=1
+			fi
+		done
+	done
+done
+rm -f /tmp/check_replay.trc
+exit $status
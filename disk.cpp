@@ -5,19 +5,50 @@ Make all of your changes to main.cpp instead.
 
 #include "disk.h"
 
+#include <algorithm>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 using std::cerr;
 using std::endl;
 
+// Staging buffer for one queued write
+struct disk_slot
+{
+    int block;
+    bool inflight;
+    char *data;
+};
+
 struct disk
 {
     int fd;
     int block_size;
     int nblocks;
+    bool direct; // opened with O_DIRECT, see disk_direct_io
+
+    // Asynchronous writes, only used after disk_async_start
+    std::thread *io_thread;
+    std::mutex lock;
+    std::condition_variable submitted;
+    std::condition_variable completed;
+    bool stopping;
+    char *staging;
+    std::vector<disk_slot> slots;
+    std::vector<int> free_slots;
+    std::vector<int> queue;   // slots waiting for the I/O thread
+    std::vector<int> pending; // newest queued or in flight slot of each block, or -1
+    int busy;                 // slots queued or in flight
 };
 
 struct disk *disk_open(const char *diskname, int nblocks)
@@ -37,6 +68,9 @@ struct disk *disk_open(const char *diskname, int nblocks)
 
     d->block_size = BLOCK_SIZE;
     d->nblocks = nblocks;
+    d->direct = false;
+    d->io_thread = 0;
+    d->staging = 0;
 
     if (ftruncate(d->fd, d->nblocks * d->block_size) < 0)
     {
@@ -48,6 +82,69 @@ struct disk *disk_open(const char *diskname, int nblocks)
     return d;
 }
 
+int disk_direct_io(struct disk *d)
+{
+    int flags = fcntl(d->fd, F_GETFL);
+    if (flags < 0 || fcntl(d->fd, F_SETFL, flags | O_DIRECT) < 0)
+    {
+        return 0;
+    }
+    d->direct = true;
+    return 1;
+}
+
+// Read or write "count" adjacent blocks from "block" with one preadv or
+// pwritev per IOV_MAX of them. With direct I/O a buffer that is not aligned
+// to a block goes through a bounce buffer, one block at a time.
+static void disk_transfer(struct disk *d, bool write, int block, char *const *data, int count)
+{
+    alignas(BLOCK_SIZE) static thread_local char bounce[BLOCK_SIZE];
+    struct iovec iov[64];
+    const int max_iov = std::min(64, IOV_MAX);
+    auto aligned = [d](const char *p) { return !d->direct || (uintptr_t)p % d->block_size == 0; };
+
+    int i = 0;
+    while (i < count)
+    {
+        int first = block + i;
+        int n = 0;
+        if (aligned(data[i]))
+        {
+            while (i + n < count && n < max_iov && aligned(data[i + n]))
+            {
+                iov[n].iov_base = data[i + n];
+                iov[n].iov_len = d->block_size;
+                n++;
+            }
+        }
+        else
+        {
+            if (write)
+            {
+                memcpy(bounce, data[i], d->block_size);
+            }
+            iov[0].iov_base = bounce;
+            iov[0].iov_len = d->block_size;
+            n = 1;
+        }
+
+        ssize_t expected = (ssize_t)n * d->block_size;
+        off_t offset = (off_t)first * d->block_size;
+        ssize_t actual = write ? pwritev(d->fd, iov, n, offset) : preadv(d->fd, iov, n, offset);
+        if (actual != expected)
+        {
+            cerr << (write ? "disk_write: failed to write block #" : "disk_read: failed to read block #") << first
+                 << ": " << strerror(errno) << endl;
+            abort();
+        }
+        if (!write && iov[0].iov_base == bounce)
+        {
+            memcpy(data[i], bounce, d->block_size);
+        }
+        i += n;
+    }
+}
+
 void disk_write(struct disk *d, int block, const char *data)
 {
     if (block < 0 || block >= d->nblocks)
@@ -56,12 +153,16 @@ void disk_write(struct disk *d, int block, const char *data)
         abort();
     }
 
-    int actual = pwrite(d->fd, data, d->block_size, block * d->block_size);
-    if (actual != d->block_size)
+    if (d->io_thread)
     {
-        cerr << "disk_write: failed to write block #" << block << ": " << strerror(errno) << endl;
-        abort();
+        // Must not overtake a queued write of the same block
+        disk_write_async(d, block, data);
+        disk_sync(d);
+        return;
     }
+
+    char *buffer = (char *)data;
+    disk_transfer(d, true, block, &buffer, 1);
 }
 
 void disk_read(struct disk *d, int block, char *data)
@@ -72,12 +173,243 @@ void disk_read(struct disk *d, int block, char *data)
         abort();
     }
 
-    int actual = pread(d->fd, data, d->block_size, block * d->block_size);
-    if (actual != d->block_size)
+    disk_readv(d, block, &data, 1);
+}
+
+void disk_readv(struct disk *d, int block, char *const *data, int count)
+{
+    if (block < 0 || count < 0 || block > d->nblocks - count)
+    {
+        cerr << "disk_read: invalid block #" << block << " (" << count << " blocks)" << endl;
+        abort();
+    }
+
+    if (!d->io_thread)
+    {
+        disk_transfer(d, false, block, data, count);
+        return;
+    }
+
+    // Blocks still queued come from their staging buffers, the runs of
+    // the others from the disk, 64 blocks at a time
+    for (int i = 0; i < count; i += 64)
+    {
+        int n = std::min(64, count - i);
+        uint64_t staged = 0;
+        {
+            std::lock_guard<std::mutex> guard(d->lock);
+            for (int j = 0; j < n; j++)
+            {
+                int slot = d->pending[block + i + j];
+                if (slot >= 0)
+                {
+                    memcpy(data[i + j], d->slots[slot].data, d->block_size);
+                    staged |= (uint64_t)1 << j;
+                }
+            }
+        }
+
+        int j = 0;
+        while (j < n)
+        {
+            if (staged >> j & 1)
+            {
+                j++;
+                continue;
+            }
+            int run = 1;
+            while (j + run < n && !(staged >> (j + run) & 1))
+            {
+                run++;
+            }
+            disk_transfer(d, false, block + i + j, data + i + j, run);
+            j += run;
+        }
+    }
+}
+
+// Queue a write for the I/O thread, with the disk locked
+static void disk_queue(struct disk *d, int block, const char *data, std::unique_lock<std::mutex> &guard)
+{
+    // A write still waiting in the queue is simply replaced
+    int slot = d->pending[block];
+    if (slot >= 0 && !d->slots[slot].inflight)
+    {
+        memcpy(d->slots[slot].data, data, d->block_size);
+        return;
+    }
+
+    if (d->free_slots.empty())
+    {
+        // The blocks queued so far must go out to free a slot
+        d->submitted.notify_one();
+        d->completed.wait(guard, [d] { return !d->free_slots.empty(); });
+    }
+    slot = d->free_slots.back();
+    d->free_slots.pop_back();
+
+    d->slots[slot].block = block;
+    memcpy(d->slots[slot].data, data, d->block_size);
+    d->pending[block] = slot;
+    d->queue.push_back(slot);
+    d->busy++;
+}
+
+void disk_writev(struct disk *d, int block, const char *const *data, int count)
+{
+    if (block < 0 || count < 0 || block > d->nblocks - count)
+    {
+        cerr << "disk_write: invalid block #" << block << " (" << count << " blocks)" << endl;
+        abort();
+    }
+
+    if (d->io_thread)
+    {
+        // Queued together, so the I/O thread takes them in one batch
+        std::unique_lock<std::mutex> guard(d->lock);
+        for (int i = 0; i < count; i++)
+        {
+            disk_queue(d, block + i, data[i], guard);
+        }
+        d->submitted.notify_one();
+        return;
+    }
+
+    disk_transfer(d, true, block, const_cast<char *const *>(data), count);
+}
+
+// Write a batch of distinct blocks, one pwritev per run of adjacent blocks
+static void disk_write_batch(struct disk *d, std::vector<int> &batch, std::vector<struct iovec> &iov)
+{
+    std::sort(batch.begin(), batch.end(), [d](int a, int b) {
+        return d->slots[a].block < d->slots[b].block;
+    });
+
+    size_t i = 0;
+    while (i < batch.size())
+    {
+        int first = d->slots[batch[i]].block;
+        iov.clear();
+        do
+        {
+            struct iovec v = {d->slots[batch[i]].data, (size_t)d->block_size};
+            iov.push_back(v);
+            i++;
+        } while (i < batch.size() && iov.size() < IOV_MAX &&
+                 d->slots[batch[i]].block == first + (int)iov.size());
+
+        ssize_t expected = (ssize_t)iov.size() * d->block_size;
+        ssize_t actual = pwritev(d->fd, iov.data(), iov.size(), (off_t)first * d->block_size);
+        if (actual != expected)
+        {
+            cerr << "disk_write: failed to write block #" << first << ": " << strerror(errno) << endl;
+            abort();
+        }
+    }
+}
+
+static void disk_io_thread(struct disk *d)
+{
+    // The queue and the batch are swapped, both must hold every slot so that
+    // disk_write_async never grows the queue on the fault path
+    std::vector<int> batch;
+    std::vector<struct iovec> iov;
+    batch.reserve(d->slots.size());
+    iov.reserve(d->slots.size());
+    std::unique_lock<std::mutex> guard(d->lock);
+
+    for (;;)
+    {
+        d->submitted.wait(guard, [d] { return d->stopping || !d->queue.empty(); });
+        if (d->queue.empty())
+        {
+            return;
+        }
+
+        batch.swap(d->queue);
+        for (int slot : batch)
+        {
+            d->slots[slot].inflight = true;
+        }
+        guard.unlock();
+
+        disk_write_batch(d, batch, iov);
+
+        guard.lock();
+        for (int slot : batch)
+        {
+            disk_slot &s = d->slots[slot];
+            if (d->pending[s.block] == slot)
+            {
+                d->pending[s.block] = -1;
+            }
+            s.inflight = false;
+            d->free_slots.push_back(slot);
+            d->busy--;
+        }
+        batch.clear();
+        d->completed.notify_all();
+    }
+}
+
+int disk_async_start(struct disk *d, int depth)
+{
+    if (d->io_thread || depth < 1)
+    {
+        return 0;
+    }
+
+    // Aligned to a block, as direct I/O wants it
+    d->staging = (char *)aligned_alloc(d->block_size, (size_t)depth * d->block_size);
+    if (!d->staging)
     {
-        cerr << "disk_read: failed to read block #" << block << ": " << strerror(errno) << endl;
+        return 0;
+    }
+    d->slots.resize(depth);
+    for (int i = 0; i < depth; i++)
+    {
+        d->slots[i].block = -1;
+        d->slots[i].inflight = false;
+        d->slots[i].data = d->staging + (size_t)i * d->block_size;
+        d->free_slots.push_back(depth - 1 - i);
+    }
+    d->queue.reserve(depth);
+    d->pending.assign(d->nblocks, -1);
+    d->busy = 0;
+    d->stopping = false;
+
+    d->io_thread = new std::thread(disk_io_thread, d);
+    return 1;
+}
+
+void disk_write_async(struct disk *d, int block, const char *data)
+{
+    if (!d->io_thread)
+    {
+        disk_write(d, block, data);
+        return;
+    }
+
+    if (block < 0 || block >= d->nblocks)
+    {
+        cerr << "disk_write: invalid block #" << block << endl;
         abort();
     }
+
+    std::unique_lock<std::mutex> guard(d->lock);
+    disk_queue(d, block, data, guard);
+    d->submitted.notify_one();
+}
+
+void disk_sync(struct disk *d)
+{
+    if (!d->io_thread)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> guard(d->lock);
+    d->completed.wait(guard, [d] { return d->busy == 0; });
 }
 
 int disk_nblocks(struct disk *d)
@@ -87,6 +419,18 @@ int disk_nblocks(struct disk *d)
 
 void disk_close(struct disk *d)
 {
+    if (d->io_thread)
+    {
+        {
+            std::lock_guard<std::mutex> guard(d->lock);
+            d->stopping = true;
+        }
+        d->submitted.notify_one();
+        d->io_thread->join();
+        delete d->io_thread;
+        free(d->staging);
+    }
+
     close(d->fd);
     delete d;
 }
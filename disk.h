@@ -32,6 +32,59 @@ and "data" is a pointer to where the data will be placed.
 
 void disk_read(struct disk *d, int block, char *data);
 
+/*
+Write "count" adjacent blocks starting at "block", the first from data[0],
+the next from data[1] and so on, with one pwritev call for the whole run.
+Like disk_write_async, the blocks are only queued once disk_async_start was
+called, and the I/O thread writes them back as one run.
+*/
+
+void disk_writev(struct disk *d, int block, const char *const *data, int count);
+
+/*
+Read "count" adjacent blocks starting at "block" into data[0], data[1] and
+so on, with one preadv call for the whole run. Blocks that are still queued
+are copied from their staging buffers instead.
+*/
+
+void disk_readv(struct disk *d, int block, char *const *data, int count);
+
+/*
+Bypass the page cache of the host: every transfer goes straight to the
+device with O_DIRECT, so the disk behaves like one and the host's memory
+doesn't hide the cost of swapping. Buffers aligned to BLOCK_SIZE, like the
+frames of physical memory, are used as they are, any other block is copied
+through an aligned buffer. Returns 0 if the file system doesn't allow it.
+*/
+
+int disk_direct_io(struct disk *d);
+
+/*
+Start a background I/O thread for the disk, with "depth" staging buffers.
+From then on disk_write_async only copies the block into a free staging
+buffer and returns; the thread takes every queued write at once, sorts the
+batch by block and writes runs of adjacent blocks with one pwritev call.
+disk_read serves blocks that are still queued from their staging buffer, so
+callers always read back what they wrote last. Returns 0 on failure.
+*/
+
+int disk_async_start(struct disk *d, int depth);
+
+/*
+Queue a write of exactly BLOCK_SIZE bytes to a given block. The data is
+copied before returning, so the caller may reuse it immediately. Waits only
+when all staging buffers are busy. Without disk_async_start this is the same
+as disk_write.
+*/
+
+void disk_write_async(struct disk *d, int block, const char *data);
+
+/*
+Wait until every queued write has reached the virtual disk.
+*/
+
+void disk_sync(struct disk *d);
+
 /*
 Return the number of blocks in the virtual disk.
 */
@@ -39,7 +92,7 @@ Return the number of blocks in the virtual disk.
 int disk_nblocks(struct disk *d);
 
 /*
-Close the virtual disk.
+Close the virtual disk, after writing out anything still queued.
 */
 
 void disk_close(struct disk *d);
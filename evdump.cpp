@@ -0,0 +1,122 @@
+/*
+Decoder for the event logs of "virtmem ... --events".
+Prints one event per line, or with --json the Chrome trace format that
+chrome://tracing and Perfetto open: faults as slices on the timeline of the
+thread that handled them, everything else as instant events.
+
+usage: ./evdump <eventfile> [--json]
+*/
+
+#include "evlog.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || (argc == 3 && strcmp(argv[2], "--json") != 0) || argc > 3)
+    {
+        cerr << "usage: ./evdump <eventfile> [--json]" << endl;
+        return 1;
+    }
+    bool json = argc == 3;
+
+    ifstream file(argv[1], ios::binary);
+    char magic[8];
+    uint32_t event_size = 0;
+    uint64_t count = 0, overwritten = 0;
+    double ns_per_tick = 1;
+    file.read(magic, sizeof(magic));
+    file.read((char *)&event_size, sizeof(event_size));
+    file.read((char *)&count, sizeof(count));
+    file.read((char *)&overwritten, sizeof(overwritten));
+    file.read((char *)&ns_per_tick, sizeof(ns_per_tick));
+    if (!file.good() || memcmp(magic, "VMEVLOG1", sizeof(magic)) != 0 ||
+        event_size != sizeof(struct evlog_event))
+    {
+        cerr << "ERROR: " << argv[1] << " is not an event log" << endl;
+        return 1;
+    }
+    vector<struct evlog_event> events(count);
+    file.read((char *)events.data(), count * event_size);
+    if (!file.good())
+    {
+        cerr << "ERROR: " << argv[1] << " is truncated" << endl;
+        return 1;
+    }
+
+    // A fault is logged when it is over but stamped with its start, so the
+    // log is only roughly in order
+    stable_sort(events.begin(), events.end(),
+                [](const struct evlog_event &a, const struct evlog_event &b) { return a.time < b.time; });
+    uint64_t origin = count > 0 ? events[0].time : 0;
+    if (json)
+    {
+        printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"overwritten\":%llu},\"traceEvents\":[",
+               (unsigned long long)overwritten);
+    }
+    else if (overwritten > 0)
+    {
+        printf("(%llu older events were overwritten)\n", (unsigned long long)overwritten);
+    }
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        const struct evlog_event &e = events[i];
+        const char *name = e.type < EV_NTYPES ? evlog_type_names[e.type] : "unknown";
+        double us = (e.time - origin) * ns_per_tick / 1e3;
+        double duration_us = e.duration * ns_per_tick / 1e3;
+        if (json)
+        {
+            printf("%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,", i > 0 ? "," : "", name,
+                   e.duration > 0 ? "X" : "i", us);
+            if (e.duration > 0)
+            {
+                printf("\"dur\":%.3f,", duration_us);
+            }
+            else
+            {
+                printf("\"s\":\"t\",");
+            }
+            printf("\"pid\":%u,\"tid\":%u,\"args\":{\"page\":%d,\"frame\":%d,\"arg\":%u}}", e.tenant, e.thread,
+                   e.page, e.frame, e.arg);
+        }
+        else
+        {
+            printf("%14.3f us  tenant %u  thread %u  %-9s page %d frame %d", us, e.tenant, e.thread, name, e.page,
+                   e.frame);
+            if (e.type == EV_FAULT && e.arg)
+            {
+                printf(" write");
+            }
+            else if (e.type == EV_MINOR && e.arg)
+            {
+                printf(" copy");
+            }
+            else if (e.type == EV_EVICT && e.arg)
+            {
+                printf(" dirty");
+            }
+            else if (e.type == EV_PROTECT)
+            {
+                printf(" %c%c", e.arg & 1 ? 'r' : '-', e.arg & 2 ? 'w' : '-');
+            }
+            if (e.duration > 0)
+            {
+                printf(" (%.3f us)", duration_us);
+            }
+            printf("\n");
+        }
+    }
+    if (json)
+    {
+        printf("\n]}\n");
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "evlog.h"
+#include "stats.h"
+
+#include <fstream>
+#include <new>
+
+const char *const evlog_type_names[EV_NTYPES] = { "fault", "minor", "evict", "writeback", "read",
+                                                  "protect", "merge" };
+
+static std::atomic<uint32_t> next_thread{ 1 };
+static thread_local uint32_t this_thread = 0;
+
+uint32_t evlog_thread()
+{
+    if (this_thread == 0)
+    {
+        this_thread = next_thread++;
+    }
+    return this_thread;
+}
+
+struct evlog *evlog_create(long capacity)
+{
+    uint64_t size = 1;
+    while ((long)size < capacity)
+    {
+        size *= 2;
+    }
+    // Not initialized, so the pages of the ring are only touched as it fills
+    struct evlog_event *events = new (std::nothrow) struct evlog_event[size];
+    if (!events)
+    {
+        return 0;
+    }
+    struct evlog *log = new struct evlog;
+    log->events = events;
+    log->mask = size - 1;
+    log->head = 0;
+    return log;
+}
+
+int evlog_save(struct evlog *log, const char *filename)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        return 0;
+    }
+    uint64_t head = log->head;
+    uint64_t size = log->mask + 1;
+    uint64_t count = head < size ? head : size;
+    uint64_t overwritten = head - count;
+    uint32_t event_size = sizeof(struct evlog_event);
+    double ns_per_tick = stats_ns_per_tick();
+
+    file.write("VMEVLOG1", 8);
+    file.write((const char *)&event_size, sizeof(event_size));
+    file.write((const char *)&count, sizeof(count));
+    file.write((const char *)&overwritten, sizeof(overwritten));
+    file.write((const char *)&ns_per_tick, sizeof(ns_per_tick));
+    // The oldest event is at the head once the ring has wrapped around
+    uint64_t first = overwritten & log->mask;
+    file.write((const char *)(log->events + first), (count - first) * event_size);
+    file.write((const char *)log->events, first * event_size);
+    return file.good();
+}
+
+void evlog_delete(struct evlog *log)
+{
+    delete[] log->events;
+    delete log;
+}
@@ -0,0 +1,99 @@
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <atomic>
+#include <stdint.h>
+
+/*
+Event log of the fault path: a preallocated ring of fixed-size binary
+events. Adding an event is one atomic increment and a 32 byte store, with
+no lock and no allocation, so it can be done from a signal handler and from
+several threads at once. When the ring is full the oldest events are
+overwritten. The log is saved once the run is over, and decoded offline by
+evdump into text or Chrome trace JSON.
+
+An event file starts with "VMEVLOG1", the size of an event (uint32), the
+number of events saved (uint64), the number that were overwritten (uint64)
+and the nanoseconds per tick of the timestamps (double), in the byte order
+of the machine that wrote it. The events follow, oldest first.
+*/
+
+enum evlog_type
+{
+    EV_FAULT,     // a major fault on "page", loaded into "frame", "arg" 1 if a write
+    EV_MINOR,     // a write to the read-only "page" in "frame", "arg" 1 if it got a copy of a shared frame
+    EV_EVICT,     // "page" left "frame", "arg" 1 if it was dirty
+    EV_WRITEBACK, // "page" in "frame" was written to swap, "arg" blocks went to the disk
+    EV_READ,      // "page" was read from swap into "frame", "arg" 0 if the disk was not read
+    EV_PROTECT,   // "page" in "frame" was mapped with the bits "arg"
+    EV_MERGE,     // "page" was merged into "frame", which holds the same contents
+    EV_NTYPES
+};
+
+extern const char *const evlog_type_names[EV_NTYPES];
+
+struct evlog_event
+{
+    uint64_t time;     // stats_now ticks
+    uint32_t duration; // ticks, 0 for an instant
+    int32_t page;
+    int32_t frame;
+    uint32_t thread;   // 1 for the first thread that added an event, and so on
+    uint16_t tenant;
+    uint8_t type;
+    uint8_t arg;
+    uint32_t reserved;
+};
+
+struct evlog
+{
+    struct evlog_event *events;
+    uint64_t mask;
+    std::atomic<uint64_t> head;
+};
+
+/*
+Create a log that keeps the last "capacity" events, rounded up to a power
+of two. Returns null if there is no memory for it.
+*/
+
+struct evlog *evlog_create(long capacity);
+
+/* Number of the calling thread in the events. */
+
+uint32_t evlog_thread();
+
+/*
+Add an event. "duration" is in ticks from "time", 0 for an instant.
+*/
+
+static inline void evlog_add(struct evlog *log, int type, int tenant, int page, int frame, int arg, uint64_t time,
+                             uint64_t duration = 0)
+{
+    uint64_t i = log->head.fetch_add(1, std::memory_order_relaxed);
+    struct evlog_event &e = log->events[i & log->mask];
+    e.time = time;
+    e.duration = duration < UINT32_MAX ? duration : UINT32_MAX;
+    e.page = page;
+    e.frame = frame;
+    e.thread = evlog_thread();
+    e.tenant = tenant;
+    e.type = type;
+    e.arg = arg;
+    e.reserved = 0;
+}
+
+/*
+Write the events to the file "filename", oldest first. No event may be
+added meanwhile. Returns 0 on failure.
+*/
+
+int evlog_save(struct evlog *log, const char *filename);
+
+/*
+Free the log.
+*/
+
+void evlog_delete(struct evlog *log);
+
+#endif
@@ -9,6 +9,12 @@ how to use the page table and disk interfaces.
 #include "page_table.h"
 #include "disk.h"
 #include "program.h"
+#include "policy.h"
+#include "trace.h"
+#include "stackdist.h"
+#include "stats.h"
+#include "evlog.h"
+#include "swap.h"
 
 #include <cassert>
 #include <iostream>
@@ -18,494 +24,2433 @@ how to use the page table and disk interfaces.
 #include <stack>
 #include <algorithm>
 #include <fstream>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
 // Prototype for test program
 typedef void (*program_f)(char *data, int length);
+// and for the multi-threaded ones
+typedef void (*program_mt_f)(char *data, int length, int nthreads);
 
 // Number of physical frames
 int num_frames;
 int npages;
 
+// Log the events of every fault, set by --events
 bool printflag = false;
+struct evlog *event_log = nullptr;
 
-// Pointer to disk for access from handlers
-struct disk *disk = nullptr;
-vector<bool> frames_used;
+// Disk file of the first tenant, the others add ".<id>"
+std::string disk_name = "myvirtualdisk";
 
-queue <int> fifo_queue; // FIFO queue for page replacement
-// vector <int> no_write;
-
-struct clock_entry {
-    int page;
-    bool used;
+// Optional features, given as "--name" or "--name=value" after the usual arguments
+struct vm_options {
+    int async_io_depth; // staging buffers for background disk writes, 0 to write synchronously
+    int writeback_ratio; // percent of dirty frames the writeback thread allows, -1 for no thread
+    int readahead_limit; // largest read-ahead window in pages, 0 for no read-ahead
+    int fault_around;    // pages loaded together around a fault, 1 for just the faulting page
+    bool map_write;      // map a page writable right away when the fault is a write
+    page_table_backend backend;
+    int threads;         // threads of the -mt programs, 0 for one per core
+    int quota;           // frames each tenant may hold, 0 for the default
+    bool global_replacement; // a tenant may evict pages of other tenants
+    int jobs;            // batch runs at once, 0 for one per core
+    unsigned seed;       // for the programs and the policies that choose at random
+    double sample_rate;  // fraction of the pages the miss curve follows, 1 for all
+    const char *stats_file; // where a run writes its fault latencies, null for nowhere
+    const char *events_file; // where a run saves its event log, null for no log
+    long events_size;        // events the log keeps
+    int zswap_pages;         // size of the compressed swap pool in pages, 0 for a quarter of the quota, -1 for none
+    int merge_pages;         // frames the merge thread hashes after each major fault, 0 for no thread
+    int evict_cluster;       // dirty pages written together when a dirty page is evicted, 1 for just that one
+    bool direct_io;          // bypass the host's page cache for the disk
+    bool compactor;          // compact the swap log in a background thread, rather than when a write runs short
 };
-vector <clock_entry> clock_entries;
-int clock_index = 0;
+vm_options options = { 0, -1, 0, 1, false, PAGE_TABLE_REMAP, 0, 0, false, 0, 0, 1, nullptr, nullptr, 1 << 20, -1, 0, 1,
+                       false, false };
+
+// Largest --fault-around, --readahead and --evict-cluster, the fault path
+// keeps the pages and frames of a cluster on the stack rather than allocate
+const int max_cluster = 256;
 
+// The runs of batch mode: every combination of these, each "repeat" times.
+// Empty lists take the defaults of run_batch.
+struct sweep_grid {
+    vector<int> npages;
+    vector<int> frames;
+    vector<std::string> algorithms;
+    vector<std::string> programs;
+    vector<int> seeds;
+    int repeat;
+    bool csv;  // also write every run to outputs/output.csv
+    bool plot; // run graph.py on the CSV afterwards
+};
+sweep_grid grid = { {}, {}, {}, {}, {}, 1, false, false };
 
-int total_page_faults;
-int total_disk_writes;
-int total_disk_reads;
+const char *const backend_names[] = { "remap", "mmap", "uffd", "uffd-thread" };
+const int nbackends = 4;
 
-// Handler with random choice of eviction
-void page_fault_handler_random_eviction(struct page_table *pt, int page) {
-    if (printflag) {
-        cout << "page fault on page #" << page << endl;
-        // Print the page table contents
-        cout << "Before ---------------------------" << endl;
-        page_table_print(pt);
-        cout << "----------------------------------" << endl;
+// If "arg" is the option "name", return its value ("" if none was given), otherwise null
+const char *match_option(const char *arg, const char *name) {
+    size_t length = strlen(name);
+    if (strncmp(arg, name, length) != 0) {
+        return nullptr;
+    }
+    if (arg[length] == '=') {
+        return arg + length + 1;
     }
+    return arg[length] == '\0' ? arg + length : nullptr;
+}
 
-    // case for chnageing page to W
-    int* bits = new int;
-    int* framenumber = new int;
-    page_table_get_entry(pt, page, framenumber, bits);
-    if (*bits == PROT_READ ) // making a page dirty
-    {
-        page_table_set_entry(pt, page, *framenumber, PROT_READ | PROT_WRITE);
-    } else if (*bits != PROT_READ) { // if the page needs to be alloced in Physcial mem
-        total_page_faults++;
-        // we need at add this to the page table 
-        //check if frames are available
-        bool already_allocated = false;
-        for (int i = 0; i < page_table_get_nframes(pt); i++) {
-            if (frames_used[i] == false) {
-                // Found an empty frame
-                frames_used[i] = true;
-                disk_read(disk, page, page_table_get_physmem(pt) + (i * PAGE_SIZE));
-                total_disk_reads++;
-                page_table_set_entry(pt, page, i, PROT_READ);
-                already_allocated = true;
-                break;
+// Split "value" at commas
+vector<std::string> parse_list(const char *value) {
+    vector<std::string> items;
+    std::string item;
+    for (const char *c = value;; c++) {
+        if (*c == ',' || *c == '\0') {
+            if (!item.empty()) {
+                items.push_back(item);
             }
-        }
-        if (!already_allocated) {
-            // No empty frames, we need to evict a page
-            vector<int> pages_in_use;
-            for (int i = 0; i < page_table_get_npages(pt); i++) {
-                int* frame = new int;
-                int* tempbits = new int;
-                page_table_get_entry(pt, i, frame, tempbits);
-                if (*tempbits != 0) {
-                    pages_in_use.push_back(i);
-                }
-                delete tempbits;
-                delete frame;
-            }
-            if (pages_in_use.empty()) {
-                cerr << "ERROR: No pages in use to evict" << endl;
-                exit(1);
-            }
-            int random_index = std::rand() % pages_in_use.size();
-            int random_page = pages_in_use[random_index];
-
-            int* replaced_page = new int;
-            *replaced_page = random_page;
-
-            int* replaced_page_bits = new int;
-            int* replaced_frame = new int;
-
-            page_table_get_entry(pt, random_page, replaced_frame, replaced_page_bits);
-
-            if (*replaced_page_bits & PROT_WRITE){
-                // Replaced page is dirty, we need to write it to the disk before replacing
-                disk_write(disk, *replaced_page, page_table_get_physmem(pt) + (*replaced_frame * PAGE_SIZE));
-                total_disk_writes++;
-            } 
-            // Replaced page is clean, we can just replace it
-            disk_read(disk, page, page_table_get_physmem(pt) + (*replaced_frame * PAGE_SIZE));
-            total_disk_reads++;
-            page_table_set_entry(pt, *replaced_page, *framenumber, PROT_NONE);
-            page_table_set_entry(pt, page, *replaced_frame, PROT_READ);
-            //frames_used[*replaced_frame] = true;
-            delete replaced_page;
-            delete replaced_frame;
-            delete replaced_page_bits;
-        }
-    }
-    delete bits;
-    delete framenumber;
-    if (printflag) {
-        // Print the page table contents
-        cout << "After ----------------------------" << endl;
-        page_table_print(pt);
-        cout << "----------------------------------" << endl;
-    }
-   
-}
-
-
-// Handler with random choice of eviction
-void page_fault_handler_fifo_eviction(struct page_table *pt, int page) {
-    if (printflag) {
-        cout << "page fault on page #" << page << endl;
-
-        // Print the page table contents
-        cout << "Before ---------------------------" << endl;
-        page_table_print(pt);
-        cout << "----------------------------------" << endl;
-    }
-    // case for chnageing page to W
-    int* bits = new int;
-    int* framenumber = new int;
-    page_table_get_entry(pt, page, framenumber, bits);
-    if (*bits == PROT_READ ) // making a page dirty
-    {
-        // std::cout << "Page is read only, changing to read/write" << endl;
-        page_table_set_entry(pt, page, *framenumber, PROT_READ | PROT_WRITE);
-    } else if (*bits != PROT_READ) { // if the page needs to be alloced in Physcial mem
-        total_page_faults++;
-        // we need at add this to the page table 
-        //check if frames are available
-        bool already_allocated = false;
-
-        for (int i = 0; i < page_table_get_nframes(pt); i++) {
-            if (frames_used[i] == false) {
-                // Found an empty frame
-                frames_used[i] = true;
-                fifo_queue.push(page);
-                disk_read(disk, page, page_table_get_physmem(pt) + (i * PAGE_SIZE));
-                total_disk_reads++;
-                page_table_set_entry(pt, page, i, PROT_READ);
-                already_allocated = true;
-                break;
+            item.clear();
+            if (*c == '\0') {
+                return items;
             }
+        } else if (*c != ' ') {
+            item += *c;
         }
-        if (!already_allocated) {
-            int* replaced_page = new int;
-            int replaced_page_temp = fifo_queue.front();
-            *replaced_page = replaced_page_temp;
-            fifo_queue.pop();
+    }
+}
 
-            int* replaced_page_bits = new int;
-            int* replaced_frame = new int;
+// Parse a list of numbers and ranges "first:last[:step]" (last included), such
+// as "5:95:5" or "10,20,50". Exits if "value" is not one.
+vector<int> parse_int_list(const char *name, const char *value) {
+    vector<int> numbers;
+    for (const std::string &item : parse_list(value)) {
+        int first, last, step = 1;
+        char end;
+        int n = sscanf(item.c_str(), "%d:%d:%d%c", &first, &last, &step, &end);
+        if (n == 1 && item.find(':') == std::string::npos) {
+            last = first;
+        } else if (n != 2 && n != 3) {
+            n = 0;
+        }
+        if (n == 0 || step < 1 || last < first) {
+            cerr << "ERROR: Bad value for " << name << ": " << item << endl;
+            exit(1);
+        }
+        for (int i = first; i <= last; i += step) {
+            numbers.push_back(i);
+        }
+    }
+    return numbers;
+}
 
-            page_table_get_entry(pt, *replaced_page, replaced_frame, replaced_page_bits);
-            
+void parse_grid_file(const char *filename);
 
-            if (*replaced_page_bits & PROT_WRITE){
-                // Replaced page is dirty, we need to write it to the disk before replacing
-                disk_write(disk, *replaced_page, page_table_get_physmem(pt) + (*replaced_frame * PAGE_SIZE));
-                total_disk_writes++;
-            } 
-            // Replaced page is clean, we can just replace it
-            disk_read(disk, page, page_table_get_physmem(pt) + (*replaced_frame * PAGE_SIZE));
-            total_disk_reads++;
-            page_table_set_entry(pt, *replaced_page, *framenumber, PROT_NONE);
+// Parse one option, returns false if it is unknown
+bool parse_option(const char *arg) {
+    const char *value;
 
-            page_table_set_entry(pt, page, *replaced_frame, PROT_READ);
-            //frames_used[*replaced_frame] = true;
-            
-            
-            fifo_queue.push(page);
-            delete replaced_page;
-            delete replaced_frame;
-            delete replaced_page_bits;
+    if ((value = match_option(arg, "--async-io"))) {
+        options.async_io_depth = *value ? atoi(value) : 32;
+    } else if ((value = match_option(arg, "--writeback"))) {
+        options.writeback_ratio = *value ? atoi(value) : 10;
+    } else if ((value = match_option(arg, "--readahead"))) {
+        options.readahead_limit = *value ? min(max(0, atoi(value)), max_cluster) : 32;
+    } else if ((value = match_option(arg, "--fault-around"))) {
+        options.fault_around = *value ? min(max(1, atoi(value)), max_cluster) : 8;
+    } else if ((value = match_option(arg, "--evict-cluster"))) {
+        options.evict_cluster = *value ? min(max(1, atoi(value)), max_cluster) : 8;
+    } else if ((value = match_option(arg, "--direct-io"))) {
+        options.direct_io = true;
+    } else if ((value = match_option(arg, "--compactor"))) {
+        options.compactor = true;
+    } else if ((value = match_option(arg, "--map-write"))) {
+        options.map_write = true;
+    } else if ((value = match_option(arg, "--backend"))) {
+        int b = 0;
+        while (b < nbackends && strcmp(value, backend_names[b]) != 0) {
+            b++;
+        }
+        if (b == nbackends) {
+            cerr << "ERROR: Unknown backend: " << value << endl;
+            exit(1);
+        }
+        options.backend = (page_table_backend)b;
+    } else if ((value = match_option(arg, "--threads"))) {
+        options.threads = *value ? max(1, atoi(value)) : 0;
+    } else if ((value = match_option(arg, "--quota")) && *value) {
+        options.quota = atoi(value);
+    } else if ((value = match_option(arg, "--global-replacement"))) {
+        options.global_replacement = true;
+    } else if ((value = match_option(arg, "--jobs")) && *value) {
+        options.jobs = max(1, atoi(value));
+    } else if ((value = match_option(arg, "--seed")) && *value) {
+        options.seed = strtoul(value, nullptr, 0);
+    } else if ((value = match_option(arg, "--sample")) && *value) {
+        options.sample_rate = atof(value);
+        if (!(options.sample_rate > 0 && options.sample_rate <= 1)) {
+            cerr << "ERROR: Bad value for --sample: " << value << endl;
+            exit(1);
         }
+    } else if ((value = match_option(arg, "--stats"))) {
+        options.stats_file = *value ? value : "outputs/stats.csv";
+    } else if ((value = match_option(arg, "--events"))) {
+        options.events_file = *value ? value : "outputs/events.evlog";
+    } else if ((value = match_option(arg, "--events-size")) && *value) {
+        options.events_size = max(1L, atol(value));
+    } else if ((value = match_option(arg, "--zswap"))) {
+        // 0 is taken by the default size, an explicit 0 means no pool
+        options.zswap_pages = !*value ? 0 : atoi(value) > 0 ? atoi(value) : -1;
+    } else if ((value = match_option(arg, "--merge"))) {
+        options.merge_pages = *value ? max(0, atoi(value)) : 64;
+    } else if ((value = match_option(arg, "--npages")) && *value) {
+        grid.npages = parse_int_list("--npages", value);
+    } else if ((value = match_option(arg, "--frames")) && *value) {
+        grid.frames = parse_int_list("--frames", value);
+    } else if ((value = match_option(arg, "--algorithms")) && *value) {
+        grid.algorithms = parse_list(value);
+    } else if ((value = match_option(arg, "--programs")) && *value) {
+        grid.programs = parse_list(value);
+    } else if ((value = match_option(arg, "--seeds")) && *value) {
+        grid.seeds = parse_int_list("--seeds", value);
+    } else if ((value = match_option(arg, "--repeat")) && *value) {
+        grid.repeat = max(1, atoi(value));
+    } else if ((value = match_option(arg, "--csv"))) {
+        grid.csv = true;
+    } else if ((value = match_option(arg, "--plot"))) {
+        grid.csv = true;
+        grid.plot = true;
+    } else if ((value = match_option(arg, "--no-csv"))) {
+        grid.csv = false;
+        grid.plot = false;
+    } else if ((value = match_option(arg, "--no-plot"))) {
+        grid.plot = false;
+    } else if ((value = match_option(arg, "--grid")) && *value) {
+        parse_grid_file(value);
+    } else {
+        return false;
     }
-    delete bits;
-    delete framenumber;
-    if (printflag) {
-        // Print the page table contents
-        cout << "After ----------------------------" << endl;
-        page_table_print(pt);
-        cout << "----------------------------------" << endl;
+    return true;
+}
+
+// Parse the options in argv[first..argc), exits on anything unknown
+void parse_options(int argc, char *argv[], int first) {
+    for (int i = first; i < argc; i++) {
+        if (!parse_option(argv[i])) {
+            cerr << "ERROR: Unknown option: " << argv[i] << endl;
+            exit(1);
+        }
     }
-    
 }
 
+// Read options from "filename", one "name = value" or "name" per line without
+// the leading "--", "#" starts a comment. Exits on errors.
+void parse_grid_file(const char *filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "ERROR: Couldn't open " << filename << endl;
+        exit(1);
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        line = line.substr(0, line.find('#'));
+        size_t equals = line.find('=');
+        std::string name = line.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : line.substr(equals + 1);
+        name.erase(std::remove(name.begin(), name.end(), ' '), name.end());
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        if (name.empty()) {
+            continue;
+        }
+        std::string option = "--" + name + (equals == std::string::npos ? "" : "=" + value);
+        if (!parse_option(option.c_str())) {
+            cerr << "ERROR: " << filename << ":" << number << ": Unknown option: " << name << endl;
+            exit(1);
+        }
+    }
+}
 
+// Pool of free frames, one bit per frame (set while the frame is free).
+// Several threads can fault at the same time, so the pool is lock free: a
+// thread first reserves a frame by decrementing "nfree", and is then sure to
+// find a set bit that it can clear with compare-and-swap. "first_word" is the
+// lowest word that may still have a free bit, only a hint under contention,
+// so an allocation never rescans words that are already fully in use.
+struct frame_pool {
+    vector<std::atomic<uint64_t>> free_bits;
+    std::atomic<int> first_word;
+    std::atomic<int> nfree;
+};
 
-void page_fault_handler_custom_eviction(struct page_table *pt, int page) {
-    if (printflag) {
-        cout << "page fault on page #" << page << endl;
+// The physical frames, shared by all tenants
+frame_pool free_frames;
 
-        // Print the page table contents
-        cout << "Before ---------------------------" << endl;
-        page_table_print(pt);
-        cout << "----------------------------------" << endl;
+void frame_pool_init(frame_pool &fp, int nframes) {
+    fp.free_bits = vector<std::atomic<uint64_t>>((nframes + 63) / 64);
+    for (int i = 0; i < nframes; i++) {
+        fp.free_bits[i / 64] |= (uint64_t)1 << (i % 64);
     }
-    // case for chnageing page to W
-    int* bits = new int;
-    int* framenumber = new int;
-    page_table_get_entry(pt, page, framenumber, bits);
-    if (*bits == PROT_READ ) // making a page dirty
-    {
-        // std::cout << "Page is read only, changing to read/write" << endl;
-        page_table_set_entry(pt, page, *framenumber, PROT_READ | PROT_WRITE);
-        for (int i = 0; i < clock_entries.size(); i++) {
-            if (clock_entries[i].page == page) {
-                clock_entries[i].used = true;
-                break;
+    fp.first_word = 0;
+    fp.nfree = nframes;
+}
+
+// Take the lowest numbered free frame, or return -1 if memory is full
+int frame_pool_alloc(frame_pool &fp) {
+    int nfree = fp.nfree.load(std::memory_order_relaxed);
+    do {
+        if (nfree == 0) {
+            return -1;
+        }
+    } while (!fp.nfree.compare_exchange_weak(nfree, nfree - 1));
+
+    int nwords = fp.free_bits.size();
+    for (int w = fp.first_word.load(std::memory_order_relaxed);; w = (w + 1) % nwords) {
+        uint64_t word = fp.free_bits[w].load();
+        while (word != 0) {
+            if (fp.free_bits[w].compare_exchange_weak(word, word & (word - 1))) {
+                fp.first_word.store(w, std::memory_order_relaxed);
+                return w * 64 + __builtin_ctzll(word);
             }
         }
-        
-        clock_index = (clock_index + 1) % num_frames;
-
-    } else if (*bits != PROT_READ) { // if the page needs to be alloced in Physcial mem
-        total_page_faults++;
-        // we need at add this to the page table 
-        //check if frames are available
-        bool already_allocated = false;
-
-        for (int i = 0; i < page_table_get_nframes(pt); i++) {
-            if (frames_used[i] == false) {
-                // Found an empty frame
-                frames_used[i] = true;
-                disk_read(disk, page, page_table_get_physmem(pt) + (i * PAGE_SIZE));
-                total_disk_reads++;
-                page_table_set_entry(pt, page, i, PROT_READ);
-                already_allocated = true;
-                clock_entries[i].page = page;
-                clock_entries[i].used = false;
-                break;
+    }
+}
+
+// Give a frame back to the pool
+void frame_pool_release(frame_pool &fp, int frame) {
+    int w = frame / 64;
+    fp.free_bits[w] |= (uint64_t)1 << (frame % 64);
+    int first = fp.first_word.load(std::memory_order_relaxed);
+    while (w < first && !fp.first_word.compare_exchange_weak(first, w)) {
+    }
+    fp.nfree++;
+}
+
+// A sequence of faults with a constant stride. Once the same stride is seen
+// twice the next "window" pages along it are read ahead. A fault exactly at
+// "expected", the first page past them, means they were all used, and the
+// window doubles; a fault among them means some were evicted unused, and it
+// halves.
+struct readahead_stream {
+    int last;
+    int stride;
+    int window;
+    int expected;
+    unsigned age;
+};
+
+const int readahead_streams = 8;
+const int readahead_max_stride = 64;
+
+// One simulated address space: a page table with its own virtual memory,
+// disk, eviction policy (see policy.h) and statistics. Every tenant takes its
+// frames from free_frames and holds at most "quota" of them. The page table's
+// handler data points back to its tenant.
+//
+// Locking, so that several application threads can fault at the same time.
+// page_locks[page] is held while a fault on "page" is handled, and while
+// another thread evicts, reads ahead or writes back "page". A thread only
+// ever waits for the lock of the page it faulted on: any other page lock is
+// taken with try_lock, and a busy page is skipped, so threads never wait for
+// each other in a cycle. policy_lock serializes the policy calls and is held
+// for nothing else, in particular not for disk I/O or page table updates.
+// "policy_frames" counts the frames the policy tracks, so that no thread asks
+// for a victim while every frame is being loaded or evicted by other threads.
+//
+// With --merge, a page can be merged into the frame of another page with the
+// same contents (see merge_daemon). The frame stays with the page that held
+// it, the holder, and only the holder is known to the policy. The pages
+// merged into each frame form a list, guarded by share_lock, which is only
+// changed with the page that joins or leaves it locked and, to join, its
+// holder locked too.
+struct vm_tenant {
+    int id;
+    struct page_table *pt;
+    struct disk *disk;
+    struct swap *swap;
+    eviction_policy *policy;
+    int quota;
+    std::atomic<int> frames{0}; // frames held, including those being loaded
+
+    vector<std::mutex> page_locks;
+    std::mutex policy_lock;
+    int policy_frames = 0;
+    std::atomic<int> dirty_frames{0};
+
+    readahead_stream streams[readahead_streams];
+    unsigned readahead_clock = 0;
+    std::mutex readahead_lock;
+
+    std::thread *writeback_thread = nullptr;
+    std::mutex writeback_lock;
+    std::condition_variable writeback_wakeup;
+    bool writeback_wanted = false; // a major fault happened since the last pass
+    bool writeback_stop = false;
+
+    vector<int> shared_frame; // frame each page is merged into, -1 if none
+    vector<int> share_next;
+    vector<int> share_prev;
+    vector<int> share_head;   // first page merged into each frame, -1 if none
+    std::mutex share_lock;
+    std::thread *merge_thread = nullptr;
+    std::mutex merge_lock;
+    std::condition_variable merge_wakeup;
+    bool merge_wanted = false;     // a major fault happened since the last pass
+    bool merge_stop = false;
+
+    std::atomic<int> total_page_faults{0};
+    std::atomic<int> total_disk_writes{0};
+    std::atomic<int> total_disk_reads{0};
+    std::atomic<int> total_writebacks{0};
+    std::atomic<int> total_cleaned{0};
+    std::atomic<int> total_readahead{0};
+    std::atomic<int> total_readahead_hits{0};
+    std::atomic<int> total_fault_around{0};
+    std::atomic<int> total_minor_faults{0};
+    std::atomic<int> total_merged{0};
+    std::atomic<int> total_unshared{0};
+    fault_stats stats;
+};
+
+vector<vm_tenant *> tenants;
+
+// Phases of the fault this thread is handling
+thread_local phase_timer fault_timer;
+
+// Add an event of tenant "t" to the event log, if there is one
+inline void log_event(int type, vm_tenant *t, int page, int frame, int arg = 0) {
+    if (event_log) {
+        evlog_add(event_log, type, t->id, page, frame, arg, stats_now());
+    }
+}
+
+// Writeback thread: after major faults, writes out dirty pages that the
+// policy expects to evict soon and maps them read-only again, so that when
+// they are evicted only the read of the new page is left on the fault path.
+// It sleeps while there are no faults. The next window of
+// victims is always cleaned; further candidates only while more than
+// options.writeback_ratio percent of the tenant's frames are dirty. The
+// pages are written max_cluster at a time in the order of their numbers, so
+// that they take adjacent blocks in one write and come back the same way
+// when they are read ahead.
+void writeback_daemon(vm_tenant *t) {
+    struct page_table *pt = t->pt;
+    int nframes = pt->nframes;
+    int window = max(1, t->quota / 4);
+    int dirty_limit = t->quota * options.writeback_ratio / 100;
+    vector<int> candidates(nframes);
+    vector<std::pair<int, int>> batch; // page and frame
+    vector<int> pages(max_cluster), written(max_cluster);
+    vector<const char *> data(max_cluster);
+    int cursor = 0;
+
+    auto flush = [&]() {
+        std::sort(batch.begin(), batch.end());
+        for (size_t i = 0; i < batch.size(); i++) {
+            pages[i] = batch[i].first;
+            data[i] = pt->physmem + (batch[i].second * PAGE_SIZE);
+        }
+        t->total_disk_writes += swap_writev(t->swap, pages.data(), data.data(), batch.size(), written.data());
+        for (size_t i = 0; i < batch.size(); i++) {
+            log_event(EV_WRITEBACK, t, batch[i].first, batch[i].second, written[i]);
+            t->page_locks[batch[i].first].unlock();
+        }
+        t->total_writebacks += batch.size();
+        batch.clear();
+    };
+
+    std::unique_lock<std::mutex> guard(t->writeback_lock);
+    for (;;) {
+        t->writeback_wakeup.wait(guard, [t] { return t->writeback_stop || t->writeback_wanted; });
+        if (t->writeback_stop) {
+            return;
+        }
+        t->writeback_wanted = false;
+        // Faults only take the lock to set writeback_wanted
+        guard.unlock();
+
+        int count;
+        {
+            std::lock_guard<std::mutex> policy_guard(t->policy_lock);
+            count = t->policy->eviction_candidates(candidates.data(), nframes);
+        }
+        if (count == 0) {
+            // The policy can't tell, sweep the frames in order instead
+            for (int i = 0; i < nframes; i++) {
+                candidates[i] = (cursor + i) % nframes;
             }
+            count = nframes;
+            cursor = (cursor + window) % nframes;
         }
-        if (!already_allocated) {
-            int* replaced_page = new int;
 
-            while (clock_entries[clock_index].used) {
-                clock_entries[clock_index].used = false;
-                clock_index = (clock_index + 1) % num_frames;
+        for (int i = 0; i < count && (i < window || t->dirty_frames > dirty_limit); i++) {
+            int frame = candidates[i];
+            int page = pt->frame_mapping[frame];
+            if (page < 0 || !t->page_locks[page].try_lock()) {
+                continue;
+            }
+            // Check again, the page may have been evicted before it was locked
+            if (pt->frame_mapping[frame] != page || !(pt->page_bits[page] & PROT_WRITE)) {
+                t->page_locks[page].unlock();
+                continue;
+            }
+            // Read-only first, so a later write faults and marks it dirty again.
+            // The page stays locked until it is written.
+            page_table_set_entry(pt, page, frame, PROT_READ);
+            log_event(EV_PROTECT, t, page, frame, PROT_READ);
+            t->dirty_frames--;
+            batch.push_back({ page, frame });
+            if ((int)batch.size() == max_cluster) {
+                flush();
             }
-            int replaced_page_temp = clock_entries[clock_index].page;
-            *replaced_page = replaced_page_temp;
-            
+        }
+        flush();
+        guard.lock();
+    }
+}
 
-            int* replaced_page_bits = new int;
-            int* replaced_frame = new int;
+// Have the writeback thread of "t" look for dirty pages again
+void writeback_wake(vm_tenant *t) {
+    {
+        std::lock_guard<std::mutex> guard(t->writeback_lock);
+        t->writeback_wanted = true;
+    }
+    t->writeback_wakeup.notify_one();
+}
 
-            page_table_get_entry(pt, *replaced_page, replaced_frame, replaced_page_bits);
-            
+void writeback_start(vm_tenant *t) {
+    t->writeback_stop = false;
+    t->writeback_wanted = false;
+    t->writeback_thread = new std::thread(writeback_daemon, t);
+}
 
-            if (*replaced_page_bits & PROT_WRITE){
-                // Replaced page is dirty, we need to write it to the disk before replacing
-                disk_write(disk, *replaced_page, page_table_get_physmem(pt) + (*replaced_frame * PAGE_SIZE));
-                total_disk_writes++;
-            } 
-            // Replaced page is clean, we can just replace it
-            disk_read(disk, page, page_table_get_physmem(pt) + (*replaced_frame * PAGE_SIZE));
-            total_disk_reads++;
-            page_table_set_entry(pt, *replaced_page, *framenumber, PROT_NONE);
+void writeback_finish(vm_tenant *t) {
+    if (!t->writeback_thread) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(t->writeback_lock);
+        t->writeback_stop = true;
+    }
+    t->writeback_wakeup.notify_one();
+    t->writeback_thread->join();
+    delete t->writeback_thread;
+    t->writeback_thread = nullptr;
+}
 
-            page_table_set_entry(pt, page, *replaced_frame, PROT_READ);
-            //frames_used[*replaced_frame] = true;
-            
-            clock_entries[clock_index].page = page;
-            clock_entries[clock_index].used = false;
-            clock_index = (clock_index + 1) % num_frames;
-            
-            delete replaced_page;
-            delete replaced_frame;
-            delete replaced_page_bits;
+// Hash of a page for the merge thread, in the way of XXH3: every 64 bit lane
+// adds up the products of the two halves of its words mixed with a key, two
+// lanes at a time with SSE2. Pages that hash alike are compared in full
+// before they are merged, so the hash only has to be fast.
+uint64_t page_hash(const char *data) {
+    static const uint64_t keys[8] = {
+        0xbe4ba423396cfeb8, 0x1cad21f72c81017c, 0xdb979083e96dd4de, 0x1f67b3b7a4a44072,
+        0x78e5c0cc4ee679cb, 0x2172ffcc7dd05a82, 0x8e2443f7744608b8, 0x4c263a81e69035e0,
+    };
+    uint64_t lanes[8] = { 0 };
+#ifdef __SSE2__
+    __m128i acc[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+    for (int i = 0; i < PAGE_SIZE; i += 64) {
+        for (int j = 0; j < 4; j++) {
+            __m128i words = _mm_loadu_si128((const __m128i *)(data + i) + j);
+            __m128i mixed = _mm_xor_si128(words, _mm_loadu_si128((const __m128i *)keys + j));
+            __m128i product = _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(2, 3, 0, 1)));
+            acc[j] = _mm_add_epi64(acc[j], _mm_add_epi64(product, _mm_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2))));
+        }
+    }
+    memcpy(lanes, acc, sizeof(lanes));
+#else
+    for (int i = 0; i < PAGE_SIZE; i += 64) {
+        uint64_t words[8];
+        memcpy(words, data + i, sizeof(words));
+        for (int j = 0; j < 8; j++) {
+            uint64_t mixed = words[j] ^ keys[j];
+            lanes[j] += (mixed & 0xffffffff) * (mixed >> 32) + words[j ^ 1];
         }
     }
-    delete bits;
-    delete framenumber;
-    if (printflag) {
-        // Print the page table contents
-        cout << "After ----------------------------" << endl;
-        page_table_print(pt);
-        cout << "----------------------------------" << endl;
+#endif
+    uint64_t hash = PAGE_SIZE * 0x9e3779b185ebca87;
+    for (uint64_t lane : lanes) {
+        hash = (hash ^ lane) * 0xc2b2ae3d27d4eb4f;
+        hash ^= hash >> 29;
     }
-    
+    return hash;
 }
 
+// Add "page" to the pages merged into "frame", with share_lock held
+void share_link(vm_tenant *t, int page, int frame) {
+    t->shared_frame[page] = frame;
+    t->share_prev[page] = -1;
+    t->share_next[page] = t->share_head[frame];
+    if (t->share_head[frame] >= 0) {
+        t->share_prev[t->share_head[frame]] = page;
+    }
+    t->share_head[frame] = page;
+}
 
-// TODO Handler with custom eviction
+// Take "page" out of the pages merged into its frame, with share_lock held
+void share_unlink(vm_tenant *t, int page) {
+    int prev = t->share_prev[page];
+    int next = t->share_next[page];
+    if (prev >= 0) {
+        t->share_next[prev] = next;
+    } else {
+        t->share_head[t->shared_frame[page]] = next;
+    }
+    if (next >= 0) {
+        t->share_prev[next] = prev;
+    }
+    t->shared_frame[page] = -1;
+}
 
-vector<int> mainfunc(int npages, int nframes, const char *algorithm, const char *program_name)
-{
-    // std::cout << "USAGE\n";
-    // std::cout << "npages: " << npages;
-    // std::cout << " nframes: " << nframes ;
-    // std::cout << " algorithm: " << algorithm ;
-    // std::cout << " program: " << program_name ;
-    // std::cout << endl;
+// Merge "page", which holds "frame", into the frame of "holder" if both are
+// clean and have the same contents: "page" is mapped read-only to that frame
+// and its own goes back to the pool. Returns false if they can't be merged,
+// or if another thread is using either of them.
+bool merge_page(vm_tenant *t, int page, int frame, int holder) {
+    struct page_table *pt = t->pt;
+    if (holder == page || !t->page_locks[page].try_lock()) {
+        return false;
+    }
+    if (!t->page_locks[holder].try_lock()) {
+        t->page_locks[page].unlock();
+        return false;
+    }
 
-    total_page_faults = 0;
-    total_disk_writes = 0;
-    total_disk_reads = 0;
+    // Check again with both locked, either may have changed since it was hashed
+    int holder_frame = pt->page_mapping[holder];
+    bool same = pt->page_bits[page] == PROT_READ && pt->frame_mapping[frame] == page &&
+                pt->page_bits[holder] == PROT_READ && pt->frame_mapping[holder_frame] == holder &&
+                memcmp(pt->physmem + frame * PAGE_SIZE, pt->physmem + holder_frame * PAGE_SIZE, PAGE_SIZE) == 0;
+    if (same) {
+        // A frame that others are merged into stays where it is
+        std::lock_guard<std::mutex> guard(t->share_lock);
+        same = t->share_head[frame] < 0;
+    }
+    if (same) {
+        {
+            // The frame is now as recent as the last page merged into it
+            std::lock_guard<std::mutex> policy_guard(t->policy_lock);
+            t->policy->page_removed(page, frame);
+            t->policy_frames--;
+            t->policy->page_referenced(holder, holder_frame);
+        }
+        page_table_share_entry(pt, page, holder_frame);
+        log_event(EV_MERGE, t, page, holder_frame);
+        {
+            std::lock_guard<std::mutex> guard(t->share_lock);
+            share_link(t, page, holder_frame);
+        }
+        frame_pool_release(free_frames, frame);
+        t->frames--;
+        t->total_merged++;
+    }
+    t->page_locks[holder].unlock();
+    t->page_locks[page].unlock();
+    return same;
+}
 
-    // Validate the algorithm specified
-    if ((strcmp(algorithm, "rand") != 0) &&
-        (strcmp(algorithm, "fifo") != 0) &&
-        (strcmp(algorithm, "custom") != 0))
-    {
-        cerr << "ERROR: Unknown algorithm: " << algorithm << endl;
-        exit(1);
+// Merge thread: hashes the clean pages that hold a frame, options.merge_pages
+// frames after each major fault, and merges each one into the frame of a page seen
+// before it with the same hash. The hashes are forgotten after every pass over
+// the frames. The merged pages need no frame of their own until one is
+// written, when it gets a copy again (see unshare_page), or until their frame
+// is evicted, when they are all unmapped with it (see evict).
+void merge_daemon(vm_tenant *t) {
+    struct page_table *pt = t->pt;
+    int nframes = pt->nframes;
+    // A page with each hash, in this pass, open addressed over at least twice
+    // as many slots as frames so that a pass never allocates
+    int nslots = 1;
+    while (nslots < 2 * nframes) {
+        nslots *= 2;
     }
+    vector<uint64_t> seen_hash(nslots);
+    vector<int> seen_page(nslots, -1);
+    int cursor = 0;
 
-    // Validate the program specified
-    program_f program = NULL;
-    if (!strcmp(program_name, "sort"))
-    {
-        if (nframes < 2)
-        {
-            cerr << "ERROR: nFrames >= 2 for sort program" << endl;
-            exit(1);
+    std::unique_lock<std::mutex> guard(t->merge_lock);
+    for (;;) {
+        t->merge_wakeup.wait(guard, [t] { return t->merge_stop || t->merge_wanted; });
+        if (t->merge_stop) {
+            return;
         }
+        t->merge_wanted = false;
+        guard.unlock();
 
-        program = sort_program;
+        // At most one pass at a time, the pages seen a moment ago are still the same
+        for (int i = 0; i < min(options.merge_pages, nframes); i++) {
+            int frame = cursor;
+            cursor = (cursor + 1) % nframes;
+            if (cursor == 0) {
+                std::fill(seen_page.begin(), seen_page.end(), -1);
+            }
+            int page = pt->frame_mapping[frame];
+            if (page < 0 || pt->page_bits[page] != PROT_READ) {
+                continue;
+            }
+            uint64_t hash = page_hash(pt->physmem + frame * PAGE_SIZE);
+            int slot = hash & (nslots - 1);
+            while (seen_page[slot] >= 0 && seen_hash[slot] != hash) {
+                slot = (slot + 1) & (nslots - 1);
+            }
+            if (seen_page[slot] < 0) {
+                seen_hash[slot] = hash;
+                seen_page[slot] = page;
+            } else if (!merge_page(t, page, frame, seen_page[slot])) {
+                // The page seen before may be gone, try this one next time
+                seen_page[slot] = page;
+            }
+        }
+        guard.lock();
     }
-    else if (!strcmp(program_name, "scan"))
+}
+
+// Have the merge thread of "t" hash the next frames
+void merge_wake(vm_tenant *t) {
     {
-        program = scan_program;
+        std::lock_guard<std::mutex> guard(t->merge_lock);
+        t->merge_wanted = true;
     }
-    else if (!strcmp(program_name, "focus"))
-    {
-        program = focus_program;
-    } else if (!strcmp(program_name, "custom")){
-        program = custom_program;
+    t->merge_wakeup.notify_one();
+}
+
+void merge_start(vm_tenant *t) {
+    t->merge_stop = false;
+    t->merge_wanted = false;
+    t->merge_thread = new std::thread(merge_daemon, t);
+}
+
+void merge_finish(vm_tenant *t) {
+    if (!t->merge_thread) {
+        return;
     }
-    else
     {
-        cerr << "ERROR: Unknown program: " << program_name << endl;
-        exit(1);
+        std::lock_guard<std::mutex> guard(t->merge_lock);
+        t->merge_stop = true;
     }
+    t->merge_wakeup.notify_one();
+    t->merge_thread->join();
+    delete t->merge_thread;
+    t->merge_thread = nullptr;
+}
 
-    // TODO - Any init needed
-    frames_used.resize(nframes, false);
-    for (int i = 0; i < nframes; i++) {
-        frames_used[i] = false;
+// Lock the pages merged into "frame", whose holder the caller has locked, so
+// that they can be evicted with it. Returns false, with none of them locked,
+// if another thread is using one, or if one is "page", which the caller has
+// locked already.
+bool lock_sharers(vm_tenant *t, int frame, int page) {
+    if (options.merge_pages == 0) {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(t->share_lock);
+    for (int q = t->share_head[frame]; q >= 0; q = t->share_next[q]) {
+        if (q == page || !t->page_locks[q].try_lock()) {
+            for (int r = t->share_head[frame]; r != q; r = t->share_next[r]) {
+                t->page_locks[r].unlock();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Unmap and unlock the pages locked by lock_sharers. They are clean, their
+// contents are still in the swap.
+void unmap_sharers(vm_tenant *t, int frame) {
+    if (options.merge_pages == 0) {
+        return;
     }
-    // make sure queue is empty 
-    while (!fifo_queue.empty()) {
-        fifo_queue.pop();
+    std::lock_guard<std::mutex> guard(t->share_lock);
+    while (t->share_head[frame] >= 0) {
+        int q = t->share_head[frame];
+        share_unlink(t, q);
+        page_table_set_entry(t->pt, q, frame, PROT_NONE);
+        log_event(EV_EVICT, t, q, frame, 0);
+        t->page_locks[q].unlock();
     }
+}
+
+// Clustered eviction: of the next victims in "frames", lock the ones that
+// are dirty and map them read-only, so that they can be written together
+// with the page being evicted and take the blocks after it. Their frames
+// are cleaned rather than freed, their eviction costs no write later.
+// "page" is the page the calling thread faults on, which it has locked.
+// Returns how many pages it put in "pages" and "data", still locked.
+int clean_ahead(vm_tenant *t, int page, const int *frames, int nframes, int *pages, const char **data) {
+    struct page_table *pt = t->pt;
+    int count = 0;
     for (int i = 0; i < nframes; i++) {
-        clock_entry entry;
-        entry.page = -1;
-        entry.used = false;
-        clock_entries.push_back(entry);
+        int q = pt->frame_mapping[frames[i]];
+        if (q < 0 || q == page || !t->page_locks[q].try_lock()) {
+            continue;
+        }
+        // Check again, the page may have been evicted before it was locked
+        if (pt->frame_mapping[frames[i]] != q || !(pt->page_bits[q] & PROT_WRITE)) {
+            t->page_locks[q].unlock();
+            continue;
+        }
+        page_table_set_entry(pt, q, frames[i], PROT_READ);
+        log_event(EV_PROTECT, t, q, frames[i], PROT_READ);
+        t->dirty_frames--;
+        pages[count] = q;
+        data[count] = pt->physmem + (frames[i] * PAGE_SIZE);
+        count++;
     }
+    return count;
+}
 
+// Report that "page" of tenant "t" was loaded into "frame", with its policy_lock held
+template <class Policy>
+void policy_mapped(vm_tenant *t, Policy *p, int page, int frame) {
+    p->page_mapped(page, frame);
+    t->policy_frames++;
+}
 
-    // Create a virtual disk
-    disk = disk_open("myvirtualdisk", npages);
-    if (!disk)
-    {
-        cerr << "ERROR: Couldn't create virtual disk: " << strerror(errno) << endl;
-        exit(1);
+// Give the policy of tenant "t" back the victim "page" in "frame", which is
+// busy, with its policy_lock held
+template <class Policy>
+void policy_kept(vm_tenant *t, Policy *p, int page, int frame) {
+    p->victim_busy(page, frame);
+    t->policy_frames++;
+}
+
+// Take a frame from tenant "t" by evicting the page its policy chooses, after
+// writing it back if it is dirty. "page" is the page the frame is for, -1 if
+// it goes to another tenant. Returns -1 if the tenant has no frame to give
+// because they are all being loaded, evicted or used by other threads. The
+// caller has locked "page", which is resident when unshare_page copies it
+// out of a shared frame: neither its frame nor the frame it shares is taken.
+template <class Policy>
+int evict(vm_tenant *t, Policy *p, int page) {
+    struct page_table *pt = t->pt;
+    // The frame "page" itself holds or shares can't be taken however often
+    // the policy chooses it. It is set aside so the policy chooses another
+    // frame, and given back when evict returns.
+    int own_page = -1;
+    int own_frame = -1;
+    auto give_back_own = [&]() {
+        if (own_page >= 0) {
+            policy_kept(t, p, own_page, own_frame);
+        }
+    };
+
+    std::unique_lock<std::mutex> guard(t->policy_lock);
+    for (int tries = 0;; tries++) {
+        // Give up after trying every frame once, the threads using them may
+        // be waiting for a page this thread holds
+        if (t->policy_frames == 0 || tries > t->policy_frames) {
+            give_back_own();
+            return -1;
+        }
+        int frame = p->select_victim(page);
+        t->policy_frames--;
+        int replaced_page = pt->frame_mapping[frame];
+        if (replaced_page < 0) {
+            // Nothing in the frame to write back or unmap
+            give_back_own();
+            return frame;
+        }
+        if (replaced_page == page || (page >= 0 && t->shared_frame[page] == frame)) {
+            own_page = replaced_page;
+            own_frame = frame;
+            continue;
+        }
+        if (!t->page_locks[replaced_page].try_lock()) {
+            // Another thread is using the victim, keep it and choose again
+            policy_kept(t, p, replaced_page, frame);
+            continue;
+        }
+        if (!lock_sharers(t, frame, page)) {
+            t->page_locks[replaced_page].unlock();
+            policy_kept(t, p, replaced_page, frame);
+            continue;
+        }
+        int cluster_frames[max_cluster];
+        int ncluster = 0;
+        if (options.evict_cluster > 1 && (pt->page_bits[replaced_page] & PROT_WRITE)) {
+            ncluster = p->eviction_candidates(cluster_frames, options.evict_cluster - 1);
+        }
+        give_back_own();
+        guard.unlock();
+        fault_timer.lap(PHASE_POLICY);
+
+        // Unmap before writing back, with the uffd backend that brings the frame up to date
+        bool dirty = pt->page_bits[replaced_page] & PROT_WRITE;
+        page_table_set_entry(pt, replaced_page, frame, PROT_NONE);
+        log_event(EV_EVICT, t, replaced_page, frame, dirty);
+        unmap_sharers(t, frame);
+        fault_timer.lap(PHASE_REMAP);
+        if (dirty) {
+            // Replaced page is dirty, we need to write it to the disk before replacing
+            // Queued when async I/O is on, so it overlaps with the read that follows
+            int pages[max_cluster];
+            const char *data[max_cluster];
+            int written[max_cluster];
+            pages[0] = replaced_page;
+            data[0] = pt->physmem + (frame * PAGE_SIZE);
+            int count = 1 + clean_ahead(t, page, cluster_frames, ncluster, pages + 1, data + 1);
+            t->total_disk_writes += swap_writev(t->swap, pages, data, count, written);
+            log_event(EV_WRITEBACK, t, replaced_page, frame, written[0]);
+            for (int i = 1; i < count; i++) {
+                log_event(EV_WRITEBACK, t, pages[i], pt->page_mapping[pages[i]], written[i]);
+                t->page_locks[pages[i]].unlock();
+            }
+            t->total_cleaned += count - 1;
+            t->dirty_frames--;
+            fault_timer.lap(PHASE_DISK_WRITE);
+        }
+        t->page_locks[replaced_page].unlock();
+        return frame;
     }
+}
 
-    // Create a page table
-    page_fault_handler_t page_fault_handler = NULL;
+// With global replacement, the tenant that gives up a frame when memory is
+// full: the one holding the most frames for its quota
+vm_tenant *replacement_victim() {
+    vm_tenant *victim = tenants[0];
+    for (vm_tenant *t : tenants) {
+        if ((long)t->frames * victim->quota > (long)victim->frames * t->quota) {
+            victim = t;
+        }
+    }
+    return victim;
+}
 
-    if (strcmp(algorithm, "rand") == 0)
-    {
-        page_fault_handler = page_fault_handler_random_eviction;
+// Frames tenant "t" can fill with speculative pages without evicting the ones
+// it is using: its quota, or with global replacement only the frames it holds
+// and the free ones, as other tenants may have taken the rest of its quota
+int speculative_share(vm_tenant *t) {
+    if (!options.global_replacement) {
+        return t->quota;
     }
-    else if (strcmp(algorithm, "fifo") == 0)
-    {
-        page_fault_handler = page_fault_handler_fifo_eviction;
+    return min(t->quota, t->frames + free_frames.nfree);
+}
+
+// Give "page" of tenant "t" a frame: a free one while the tenant is within
+// its quota, or else one of its own pages is evicted. With global replacement
+// a tenant within its quota that finds memory full takes the frame from
+// replacement_victim instead, but only for the page that faulted ("wait" set):
+// speculative pages taken from other tenants would evict their freshly faulted
+// pages before they are used. The caller holds the lock of "page". If every
+// frame is in use by other threads, waits for one if "wait" is set, otherwise
+// returns -1. A thread only waits while it holds no other frame.
+template <class Policy>
+int get_frame(vm_tenant *t, Policy *p, int page, bool wait) {
+    for (;;) {
+        if (t->frames.fetch_add(1) < t->quota) {
+            int frame = frame_pool_alloc(free_frames);
+            if (frame >= 0) {
+                return frame;
+            }
+            vm_tenant *victim = options.global_replacement && wait ? replacement_victim() : t;
+            if (victim != t) {
+                frame = evict(victim, victim->policy, -1);
+                if (frame >= 0) {
+                    victim->frames--;
+                    return frame;
+                }
+            }
+        }
+        t->frames--;
+
+        int frame = evict(t, p, page);
+        if (frame >= 0) {
+            return frame;
+        }
+        if (!wait) {
+            return -1;
+        }
+        std::this_thread::yield();
     }
-    else if (strcmp(algorithm, "custom") == 0)
+}
+
+// A write to "page", mapped read-only in "frame", when merging is on. If the
+// frame is shared, "page" gets a copy of it in a frame of its own, mapped
+// writable, and if "page" held the frame, one of the pages merged into it
+// takes it over. Returns the new frame, or -1 if the frame is not shared
+// and the page can simply be made writable in it.
+template <class Policy>
+int unshare_page(vm_tenant *t, Policy *p, int page, int frame) {
+    struct page_table *pt = t->pt;
+    bool holder;
     {
-        
-        page_fault_handler = page_fault_handler_custom_eviction;
+        std::lock_guard<std::mutex> guard(t->share_lock);
+        holder = t->shared_frame[page] < 0;
+        if (holder && t->share_head[frame] < 0) {
+            return -1;
+        }
     }
-    struct page_table *pt = page_table_create(npages,  nframes, page_fault_handler /* TODO - Replace with your handler(s)*/);
-    if (!pt)
-    {
-        cerr << "ERROR: Couldn't create page table: " << strerror(errno) << endl;
-        exit(1);
+
+    // No other thread can evict the frame meanwhile, that takes the lock of "page"
+    int copy = get_frame(t, p, page, true);
+    memcpy(pt->physmem + copy * PAGE_SIZE, pt->physmem + frame * PAGE_SIZE, PAGE_SIZE);
+
+    int heir = -1;
+    if (holder) {
+        // The pages faulting on their own write leave the list, wait for one that isn't
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> guard(t->share_lock);
+                if (t->share_head[frame] < 0) {
+                    break;
+                }
+                for (int q = t->share_head[frame]; q >= 0 && heir < 0; q = t->share_next[q]) {
+                    if (t->page_locks[q].try_lock()) {
+                        heir = q;
+                        share_unlink(t, q);
+                    }
+                }
+            }
+            if (heir >= 0) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+        if (heir < 0) {
+            // They all got copies of their own, the frame is not shared any more
+            frame_pool_release(free_frames, copy);
+            t->frames--;
+            return -1;
+        }
+        std::lock_guard<std::mutex> policy_guard(t->policy_lock);
+        p->page_removed(page, frame);
+        t->policy_frames--;
+    } else {
+        std::lock_guard<std::mutex> guard(t->share_lock);
+        share_unlink(t, page);
     }
 
-    // Run the specified program
-    char *virtmem = page_table_get_virtmem(pt);
-    program(virtmem, npages * PAGE_SIZE);
-    std::cout << "Total page faults: " << total_page_faults << endl;
-    std::cout << "Total disk writes: " << total_disk_writes << endl;
-    std::cout << "Total disk reads: " << total_disk_reads << endl;
+    page_table_set_entry(pt, page, copy, PROT_READ | PROT_WRITE);
+    if (heir >= 0) {
+        page_table_set_entry(pt, heir, frame, PROT_READ);
+    }
+    {
+        std::lock_guard<std::mutex> policy_guard(t->policy_lock);
+        if (heir >= 0) {
+            policy_mapped(t, p, heir, frame);
+        }
+        policy_mapped(t, p, page, copy);
+    }
+    if (heir >= 0) {
+        t->page_locks[heir].unlock();
+    }
+    t->total_unshared++;
+    return copy;
+}
 
-    std::cout << "algoithm: " << algorithm << endl;
-    std::cout << "program: " << program_name << endl;
-    std::cout << endl << endl;
-    // Clean up the page table and disk
-    page_table_delete(pt);
-    disk_close(disk);
-    
-    return { total_page_faults, total_disk_writes, total_disk_reads };
+void readahead_reset(vm_tenant *t) {
+    for (readahead_stream &s : t->streams) {
+        s = { -1, 0, 0, -1, 0 };
+    }
+    t->readahead_clock = 0;
+}
 
+// The stream that "page" continues, or the least recently used one restarted at it
+readahead_stream *readahead_find(vm_tenant *t, int page) {
+    readahead_stream *oldest = &t->streams[0];
+    readahead_stream *near = nullptr;
+    for (readahead_stream &s : t->streams) {
+        if (s.window > 0 && s.expected == page) {
+            return &s;
+        }
+        if (s.last >= 0 && !near && abs(page - s.last) <= readahead_max_stride) {
+            near = &s;
+        }
+        if (s.age < oldest->age) {
+            oldest = &s;
+        }
+    }
+    if (near) {
+        return near;
+    }
+    *oldest = { page, 0, 0, -1, 0 };
+    return oldest;
 }
 
+// Called after the fault on "page" is handled and its lock released
+template <class Policy>
+void readahead(vm_tenant *t, Policy *p, int page) {
+    struct page_table *pt = t->pt;
+    int stride, window;
+    {
+        std::lock_guard<std::mutex> guard(t->readahead_lock);
+        readahead_stream *s = readahead_find(t, page);
+        s->age = ++t->readahead_clock;
 
+        int limit = min(options.readahead_limit, max(1, speculative_share(t) / 2));
+        stride = page - s->last;
+        if (s->window > 0 && page == s->expected) {
+            s->window = min(s->window * 2, limit);
+            t->total_readahead_hits++;
+        } else if (s->window > 0 && stride != 0 && stride % s->stride == 0 &&
+                   stride / s->stride > 0 && stride / s->stride <= s->window) {
+            s->window = max(1, s->window / 2);
+        } else if (stride != 0 && stride == s->stride) {
+            if (s->window == 0) {
+                s->window = min(4, limit);
+            }
+        } else {
+            s->stride = stride;
+            s->window = 0;
+        }
+        s->last = page;
 
+        if (s->window == 0) {
+            return;
+        }
+        s->expected = page + (s->window + 1) * s->stride;
+        stride = s->stride;
+        window = s->window;
+    }
 
-int main(int argc, char *argv[]) {    
-    if (argc == 5) {
-        npages = atoi(argv[1]);
-        num_frames = atoi(argv[2]);
-        const char *algorithm = argv[3];
-        const char *program_name = argv[4];
+    // Frames first, then one read for the whole window: pages that were
+    // evicted together sit in adjacent blocks
+    int ahead_pages[max_cluster];
+    int ahead_frames[max_cluster];
+    char *ahead_data[max_cluster];
+    int reads[max_cluster];
+    int count = 0;
+    for (int k = 1; k <= window; k++) {
+        int ahead = page + k * stride;
+        if (ahead < 0 || ahead >= pt->npages) {
+            break;
+        }
+        // Skip pages that are present or that another thread is faulting on
+        if (!t->page_locks[ahead].try_lock()) {
+            continue;
+        }
+        int frame = pt->page_bits[ahead] == PROT_NONE ? get_frame(t, p, ahead, false) : -1;
+        fault_timer.lap(PHASE_POLICY);
+        if (frame < 0) {
+            t->page_locks[ahead].unlock();
+            continue;
+        }
+        ahead_pages[count] = ahead;
+        ahead_frames[count] = frame;
+        ahead_data[count] = pt->physmem + (frame * PAGE_SIZE);
+        count++;
+    }
 
-        vector<int> result = mainfunc(npages, num_frames, algorithm, program_name);
+    t->total_disk_reads += swap_readv(t->swap, ahead_pages, ahead_data, count, reads);
+    t->total_readahead += count;
+    fault_timer.lap(PHASE_DISK_READ);
+    for (int i = 0; i < count; i++) {
+        log_event(EV_READ, t, ahead_pages[i], ahead_frames[i], reads[i]);
+        page_table_set_entry(pt, ahead_pages[i], ahead_frames[i], PROT_READ);
+        log_event(EV_PROTECT, t, ahead_pages[i], ahead_frames[i], PROT_READ);
     }
-    else if (argc == 2 && argv[1] == std::string("batch")) { // usage ./virtmem batch <npages> <num_frames> 
-        printflag = false;
-        std::cout << "__________BATCH MODE__________" <<endl;
+    fault_timer.lap(PHASE_REMAP);
+    {
+        std::lock_guard<std::mutex> guard(t->policy_lock);
+        for (int i = 0; i < count; i++) {
+            policy_mapped(t, p, ahead_pages[i], ahead_frames[i]);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        t->page_locks[ahead_pages[i]].unlock();
+    }
+    fault_timer.lap(PHASE_POLICY);
+}
 
-        
+// Fault-around: load the other missing pages of the aligned cluster of
+// options.fault_around pages that "page" is in, together with it. They are
+// read with one swap_readv, and runs of adjacent pages are mapped with one
+// page_table_set_entries call. The
+// faulting page is reported to the policy last, as the most recent.
+// Pages that another thread is faulting on are left to it.
 
-        //vector <int> number_of_frames = {3,4,5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39, 40, 45, 50, 55, 60, 65, 70, 75, 80, 85, 90, 95, 100};
-        //vector <int> number_of_frames = {5, 10, 20, 50};
+template <class Policy>
+void fault_around(vm_tenant *t, Policy *p, int page, int bits) {
+    struct page_table *pt = t->pt;
+    int cluster = min(options.fault_around, max(1, speculative_share(t) / 2));
+    int first = page - page % cluster;
+    int last = min(first + cluster, pt->npages);
+    int around_pages[max_cluster];
+    int around_frames[max_cluster];
+    char *around_data[max_cluster];
+    int reads[max_cluster];
 
-        vector <char*> algorithms = { "rand", "fifo", "custom" };
-        vector <const char*> programs = { "sort", "scan", "focus" };
-        std::ofstream file("outputs/output.csv");
-        if (file.is_open()) {
-            file << "npages,nframes,algorithm,program,pagefaults,diskwrites,diskreads" << endl;
-            file.flush();
-            file.close();
-        } else {
-            std::cout << "Unable to open file";
-        }
-        vector<vector<std::string>> results; // strings so we can put it all in one vector. We can chnage it back to ints later 
-        // formatt of results. [npages, nframes, algorithm, program, pagefaults, diskwrites, diskreads]
-        npages = 100;
-        for (int i = 0; i < 100; i += 5) {
-            //num_frames = number_of_frames[i];
-            num_frames = i;
-            if (num_frames < 2) {
+    // The faulting page first, it is the only one worth waiting for a frame
+    int page_frame = get_frame(t, p, page, true);
+    fault_timer.lap(PHASE_POLICY);
+    int count = 0;
+    for (int q = first; q < last; q++) {
+        int frame = page_frame;
+        if (q != page) {
+            if (!t->page_locks[q].try_lock()) {
+                continue;
+            }
+            frame = pt->page_bits[q] == PROT_NONE ? get_frame(t, p, q, false) : -1;
+            fault_timer.lap(PHASE_POLICY);
+            if (frame < 0) {
+                t->page_locks[q].unlock();
                 continue;
             }
-            for (int j = 0; j < programs.size(); j++) {
-                const char *program_name = programs[j];
-                for (int k = 0; k < algorithms.size(); k++) {
-                    const char *algorithm = algorithms[k];
-                    vector<int>result = mainfunc(npages, num_frames, algorithm, program_name);
-                    vector<string> result_string = {
-                        std::to_string(npages),
-                        std::to_string(num_frames),
-                        algorithm,
-                        program_name,
-                        std::to_string(result[0]),
-                        std::to_string(result[1]),
-                        std::to_string(result[2])
-                    };
-                    results.push_back(result_string);
-                    std::ofstream file("outputs/output.csv", std::ios::app);
-                    if (file.is_open()) {
-                        file << npages << "," << num_frames << "," << algorithm << "," << program_name << "," << result[0] << "," << result[1] << "," << result[2] << endl;
-                        file.flush();
-                        file.close();
-                    } else {
-                        std::cout << "Unable to open file";
-                    }
-                }
-            }            
         }
-        // updates the graphs when finished 
-        int result = system("python3 graph.py");
+        around_pages[count] = q;
+        around_frames[count] = frame;
+        around_data[count] = pt->physmem + (frame * PAGE_SIZE);
+        count++;
+    }
+    // One read for the cluster, runs of adjacent blocks go in one preadv
+    t->total_disk_reads += swap_readv(t->swap, around_pages, around_data, count, reads);
+    for (int i = 0; i < count; i++) {
+        log_event(EV_READ, t, around_pages[i], around_frames[i], reads[i]);
+    }
+    fault_timer.lap(PHASE_DISK_READ);
+    t->total_fault_around += count - 1;
 
-        if (result == 0) {
-            std::cout << "Graph script ran successfully!\n";
+    int start = 0;
+    for (int i = 1; i <= count; i++) {
+        bool run_ends = i == count || around_pages[i] != around_pages[i - 1] + 1 ||
+                        around_pages[i] == page || around_pages[i - 1] == page;
+        if (run_ends) {
+            int run_bits = around_pages[start] == page ? bits : PROT_READ;
+            page_table_set_entries(pt, around_pages[start], &around_frames[start], i - start, run_bits);
+            for (int j = start; j < i; j++) {
+                log_event(EV_PROTECT, t, around_pages[j], around_frames[j], run_bits);
+            }
+            start = i;
+        }
+    }
+    fault_timer.lap(PHASE_REMAP);
+
+    {
+        std::lock_guard<std::mutex> guard(t->policy_lock);
+        for (int i = 0; i < count; i++) {
+            if (around_pages[i] != page) {
+                policy_mapped(t, p, around_pages[i], around_frames[i]);
+            }
+        }
+        policy_mapped(t, p, page, page_frame);
+    }
+    fault_timer.lap(PHASE_POLICY);
+    for (int i = 0; i < count; i++) {
+        if (around_pages[i] != page) {
+            t->page_locks[around_pages[i]].unlock();
+        }
+    }
+}
+
+// Handler shared by all policies, the policy only picks the victim.
+// It is instantiated for every policy type, so the policy calls are direct
+// and can be inlined, and for Trace on and off, so the handler used without
+// printflag logs no events of its own. The events of a traced fault span
+// from the backend getting it to the end of its read-ahead.
+template <class Policy, bool Trace>
+void page_fault_handler(struct page_table *pt, int page) {
+    vm_tenant *t = static_cast<vm_tenant *>(page_table_get_handler_data(pt));
+    Policy *p = static_cast<Policy *>(t->policy);
+    char *physmem = pt->physmem;
+
+    fault_timer.begin(page_table_fault_time(pt));
+    std::unique_lock<std::mutex> guard(t->page_locks[page]);
+    fault_timer.lap(PHASE_ENTRY);
+
+    struct page_table_entry entry = page_table_lookup(pt, page);
+    int frame = entry.frame;
+    int bits = entry.bits;
+    if (bits == (PROT_READ | PROT_WRITE) || (bits == PROT_READ && page_table_fault_is_write(pt) == 0)) {
+        // Another thread resolved this fault while we waited for the page
+    } else if (bits == PROT_READ) { // making a page dirty
+        int copy = options.merge_pages > 0 ? unshare_page(t, p, page, frame) : -1;
+        if (copy >= 0) {
+            frame = copy;
+        } else {
+            page_table_set_entry(pt, page, frame, PROT_READ | PROT_WRITE);
+        }
+        t->dirty_frames++;
+        t->total_minor_faults++;
+        {
+            std::lock_guard<std::mutex> policy_guard(t->policy_lock);
+            p->page_referenced(page, frame);
+        }
+        fault_timer.lap(PHASE_POLICY);
+        t->stats.record(fault_timer, PHASE_MINOR);
+        if (Trace) {
+            evlog_add(event_log, EV_MINOR, t->id, page, frame, copy >= 0, fault_timer.start,
+                      fault_timer.last - fault_timer.start);
+        }
+    } else { // if the page needs to be alloced in Physcial mem
+        t->total_page_faults++;
+        // A write fault can get the page writable now instead of faulting again.
+        // Always done with the uffd service thread: the faulting thread can't
+        // retry its write before the faults queued by other threads are
+        // handled, and with little memory they would evict the page first.
+        int new_bits = PROT_READ;
+        bool map_write = options.map_write || options.backend == PAGE_TABLE_UFFD_THREAD;
+        if (map_write && page_table_fault_is_write(pt) == 1) {
+            new_bits = PROT_READ | PROT_WRITE;
+        }
+
+        if (options.fault_around > 1) {
+            fault_around(t, p, page, new_bits);
+            frame = pt->page_mapping[page];
+        } else {
+            frame = get_frame(t, p, page, true);
+            fault_timer.lap(PHASE_POLICY);
+            int read = swap_read(t->swap, page, physmem + (frame * PAGE_SIZE));
+            log_event(EV_READ, t, page, frame, read);
+            t->total_disk_reads += read;
+            fault_timer.lap(PHASE_DISK_READ);
+            page_table_set_entry(pt, page, frame, new_bits);
+            log_event(EV_PROTECT, t, page, frame, new_bits);
+            fault_timer.lap(PHASE_REMAP);
+            std::lock_guard<std::mutex> policy_guard(t->policy_lock);
+            policy_mapped(t, p, page, frame);
+        }
+        if (new_bits & PROT_WRITE) {
+            t->dirty_frames++;
+            std::lock_guard<std::mutex> policy_guard(t->policy_lock);
+            p->page_referenced(page, frame);
+        }
+        fault_timer.lap(PHASE_POLICY);
+        // Read ahead without the page lock, the policy may pick this page as a victim
+        guard.unlock();
+        if (options.readahead_limit > 0) {
+            readahead(t, p, page);
+        }
+        if (t->writeback_thread) {
+            writeback_wake(t);
+        }
+        if (t->merge_thread) {
+            merge_wake(t);
+        }
+        t->stats.record(fault_timer, PHASE_MAJOR);
+        if (Trace) {
+            evlog_add(event_log, EV_FAULT, t->id, page, frame, page_table_fault_is_write(pt) == 1,
+                      fault_timer.start, fault_timer.last - fault_timer.start);
+        }
+    }
+}
+
+// The counts of a run replayed from a trace
+struct replay_result {
+    long page_faults;
+    long disk_writes;
+    long disk_reads;
+};
+
+// Replay "trace" against policy "p" with "nframes" frames, doing in memory
+// what page_fault_handler does without any of its options: every reference
+// to a page that isn't resident faults and maps it read-only, and a write to
+// a read-only page makes it writable. A straddling access is retried, like
+// the CPU does, until both of its pages are mapped. Like the swap, a dirty
+// page that its last write left same-filled is evicted without a disk write,
+// and a fault only reads the disk if its page was written there. Returns
+// false if the trace refers to a page outside of it.
+template <class Policy>
+bool replay_trace(struct trace *tr, eviction_policy *policy, int nframes, replay_result &result) {
+    Policy *p = static_cast<Policy *>(policy);
+    int npages = trace_npages(tr);
+    vector<char> page_bits(npages, PROT_NONE);
+    vector<int> page_frame(npages, -1);
+    vector<int> frame_page(nframes, -1);
+    vector<char> on_disk(npages, 0);
+    vector<char> filled(npages, 0); // same-filled since its last write
+    int used_frames = 0;
+    result = { 0, 0, 0 };
+
+    auto touch = [&](int page, bool write) {
+        if (page_bits[page] == PROT_NONE) {
+            result.page_faults++;
+            int frame;
+            if (used_frames < nframes) {
+                frame = used_frames++;
+            } else {
+                frame = p->select_victim(page);
+                int replaced_page = frame_page[frame];
+                if (page_bits[replaced_page] & PROT_WRITE) {
+                    on_disk[replaced_page] = !filled[replaced_page];
+                    result.disk_writes += on_disk[replaced_page];
+                }
+                page_bits[replaced_page] = PROT_NONE;
+            }
+            result.disk_reads += on_disk[page];
+            page_bits[page] = PROT_READ;
+            page_frame[page] = frame;
+            frame_page[frame] = page;
+            p->page_mapped(page, frame);
+        }
+        if (write && page_bits[page] == PROT_READ) {
+            page_bits[page] = PROT_READ | PROT_WRITE;
+            p->page_referenced(page, page_frame[page]);
+        }
+    };
+
+    // The page of the last read, and whether the same access wrote it
+    int last_read = -1;
+    bool last_read_written = false;
+    struct trace_cursor c = trace_begin(tr);
+    int page, flags;
+    while (trace_next(&c, &page, &flags)) {
+        if (page < 0 || page >= npages) {
+            return false;
+        }
+        if (flags & TRACE_WRITE) {
+            filled[page] = (flags & TRACE_FILLED) != 0;
+            touch(page, true);
+            last_read_written |= page == last_read;
+            continue;
+        }
+        if ((flags & TRACE_STRADDLE) && last_read >= 0) {
+            // The CPU checks the lower page first, then the other, and starts
+            // over after every fault until the access goes through
+            int pages[2] = { min(page, last_read), max(page, last_read) };
+            bool write = last_read_written;
+            for (int i = 0; i < 2;) {
+                if (page_bits[pages[i]] == PROT_NONE || (write && page_bits[pages[i]] == PROT_READ)) {
+                    touch(pages[i], write);
+                    i = 0;
+                } else {
+                    i++;
+                }
+            }
+        } else {
+            touch(page, false);
+        }
+        last_read = page;
+        last_read_written = false;
+    }
+    return true;
+}
+
+typedef bool (*replay_f)(struct trace *tr, eviction_policy *policy, int nframes, replay_result &result);
+
+// Fault handlers for each policy, from the list of policy.h
+struct fault_handler_entry {
+    const char *algorithm;
+    page_fault_handler_t handler;
+    page_fault_handler_t traced_handler;
+    replay_f replay;
+};
+
+#define FAULT_HANDLERS(name, type, args) \
+    { name, page_fault_handler<type, false>, page_fault_handler<type, true>, replay_trace<type> },
+
+const fault_handler_entry fault_handlers[] = {
+    EVICTION_POLICIES(FAULT_HANDLERS)
+};
+
+page_fault_handler_t select_fault_handler(const char *algorithm, bool trace) {
+    for (const fault_handler_entry &entry : fault_handlers) {
+        if (!strcmp(entry.algorithm, algorithm)) {
+            return trace ? entry.traced_handler : entry.handler;
+        }
+    }
+    return nullptr;
+}
+
+replay_f select_replay(const char *algorithm) {
+    for (const fault_handler_entry &entry : fault_handlers) {
+        if (!strcmp(entry.algorithm, algorithm)) {
+            return entry.replay;
+        }
+    }
+    return nullptr;
+}
+
+
+// Create tenant "id" with a virtual memory of "npages" pages and the policy
+// called "algorithm", allowed "quota" frames. The first tenant creates the
+// physical memory of "nframes" frames, the others share it. Exits on errors.
+vm_tenant *tenant_create(int id, int npages, int nframes, int quota, const char *algorithm) {
+    vm_tenant *t = new vm_tenant;
+    t->id = id;
+    t->quota = quota;
+    t->page_locks = vector<std::mutex>(npages);
+    t->shared_frame = vector<int>(npages, -1);
+    t->share_next = vector<int>(npages, -1);
+    t->share_prev = vector<int>(npages, -1);
+    t->share_head = vector<int>(nframes, -1);
+    readahead_reset(t);
+
+    // Validate the algorithm specified
+    t->policy = eviction_policy_create(algorithm, npages, nframes, quota, options.seed);
+    page_fault_handler_t page_fault_handler = select_fault_handler(algorithm, printflag);
+    if (!t->policy || !page_fault_handler)
+    {
+        cerr << "ERROR: Unknown algorithm: " << algorithm << endl;
+        exit(1);
+    }
+
+    // Create a virtual disk
+    std::string name = id == 0 ? disk_name : disk_name + "." + std::to_string(id);
+    t->disk = disk_open(name.c_str(), swap_disk_blocks(npages));
+    if (!t->disk)
+    {
+        cerr << "ERROR: Couldn't create virtual disk: " << strerror(errno) << endl;
+        exit(1);
+    }
+    if (options.direct_io && !disk_direct_io(t->disk))
+    {
+        cerr << "ERROR: The file system of " << name << " doesn't allow direct I/O" << endl;
+        exit(1);
+    }
+    if (options.async_io_depth > 0 && !disk_async_start(t->disk, options.async_io_depth))
+    {
+        cerr << "ERROR: Couldn't start disk I/O thread" << endl;
+        exit(1);
+    }
+    // The compressed pool is memory on top of the frames
+    int pool_pages = options.zswap_pages == 0 ? max(1, quota / 4) : max(0, options.zswap_pages);
+    t->swap = swap_create(t->disk, npages, (long)pool_pages * PAGE_SIZE, options.compactor);
+    if (!t->swap)
+    {
+        cerr << "ERROR: No memory for a swap pool of " << pool_pages << " pages" << endl;
+        exit(1);
+    }
+
+    // Create a page table
+    if (tenants.empty()) {
+        t->pt = page_table_create_backend(npages, nframes, page_fault_handler, options.backend);
+    } else {
+        t->pt = page_table_create_shared(npages, tenants[0]->pt, page_fault_handler, options.backend);
+    }
+    if (!t->pt)
+    {
+        cerr << "ERROR: Couldn't create page table: " << strerror(errno) << endl;
+        exit(1);
+    }
+    page_table_set_handler_data(t->pt, t);
+
+    return t;
+}
+
+// Clean up the page table, swap and disk of a tenant, after its writeback thread
+void tenant_delete(vm_tenant *t) {
+    page_table_delete(t->pt);
+    swap_delete(t->swap);
+    disk_close(t->disk);
+    if (t->id != 0) {
+        unlink((disk_name + "." + std::to_string(t->id)).c_str());
+    }
+    delete t->policy;
+    delete t;
+}
+
+// Look up the test program called "name", exits if there is none
+void select_program(const char *program_name, int nframes, program_f &program, program_mt_f &program_mt) {
+    program = NULL;
+    program_mt = NULL;
+    if (!strcmp(program_name, "sort"))
+    {
+        if (nframes < 2)
+        {
+            cerr << "ERROR: nFrames >= 2 for sort program" << endl;
+            exit(1);
+        }
+
+        program = sort_program;
+    }
+    else if (!strcmp(program_name, "scan"))
+    {
+        program = scan_program;
+    }
+    else if (!strcmp(program_name, "focus"))
+    {
+        program = focus_program;
+    } else if (!strcmp(program_name, "custom")){
+        program = custom_program;
+    } else if (!strcmp(program_name, "touch")) {
+        program = touch_program;
+    } else if (!strcmp(program_name, "scan-mt")) {
+        program_mt = scan_mt_program;
+    } else if (!strcmp(program_name, "sort-mt")) {
+        program_mt = sort_mt_program;
+    } else if (!strcmp(program_name, "focus-mt")) {
+        program_mt = focus_mt_program;
+    }
+    else
+    {
+        cerr << "ERROR: Unknown program: " << program_name << endl;
+        exit(1);
+    }
+}
+
+// Run the program on the virtual memory of tenant "t"
+void run_program(vm_tenant *t, program_f program, program_mt_f program_mt) {
+    char *virtmem = page_table_get_virtmem(t->pt);
+    int length = page_table_get_npages(t->pt) * PAGE_SIZE;
+    program_seed = options.seed;
+    if (program_mt) {
+        int nthreads = options.threads > 0 ? options.threads : max(1u, std::thread::hardware_concurrency());
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        program_mt(virtmem, length, nthreads);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        std::cout << "Threads: " << nthreads << ", elapsed: " << ms << " ms, "
+                  << (long)(t->total_page_faults / (ms / 1e3)) << " faults/s" << endl;
+    } else {
+        program(virtmem, length);
+    }
+}
+
+// Start the event log of a run if --events asked for one, before the
+// tenants are created so that they get the traced fault handler
+void events_start() {
+    if (!options.events_file) {
+        return;
+    }
+    event_log = evlog_create(options.events_size);
+    if (!event_log) {
+        cerr << "ERROR: No memory for " << options.events_size << " events" << endl;
+        exit(1);
+    }
+    printflag = true;
+}
+
+// Save the event log of a run once its threads are done
+void events_finish() {
+    if (!event_log) {
+        return;
+    }
+    if (!evlog_save(event_log, options.events_file)) {
+        cerr << "ERROR: Couldn't write " << options.events_file << endl;
+        exit(1);
+    }
+    long count = event_log->head;
+    std::cout << "Logged " << count << " events to " << options.events_file << endl;
+    evlog_delete(event_log);
+    event_log = nullptr;
+    printflag = false;
+}
+
+// Fault latencies of the last run of mainfunc
+latency_summary run_latency[NPHASES];
+
+const char *const latency_header = "phase,count,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns";
+
+// Write a row per phase of "latency", each starting with "run" (the columns
+// that tell the run apart)
+void write_latency_rows(std::ostream &out, const std::string &run, const latency_summary *latency) {
+    for (int phase = 0; phase < NPHASES; phase++) {
+        const latency_summary &l = latency[phase];
+        out << run << fault_phase_names[phase] << "," << l.count << "," << (long)l.mean << ","
+            << (long)l.p50 << "," << (long)l.p90 << "," << (long)l.p99 << "," << (long)l.p999 << ","
+            << (long)l.max << endl;
+    }
+}
+
+vector<int> mainfunc(int npages, int nframes, const char *algorithm, const char *program_name)
+{
+    // std::cout << "USAGE\n";
+    // std::cout << "npages: " << npages;
+    // std::cout << " nframes: " << nframes ;
+    // std::cout << " algorithm: " << algorithm ;
+    // std::cout << " program: " << program_name ;
+    // std::cout << endl;
+
+    // One tenant that may use all of the frames
+    frame_pool_init(free_frames, nframes);
+    events_start();
+    vm_tenant *t = tenant_create(0, npages, nframes, nframes, algorithm);
+    tenants.push_back(t);
+
+    // Validate the program specified
+    program_f program;
+    program_mt_f program_mt;
+    select_program(program_name, nframes, program, program_mt);
+
+    if (options.writeback_ratio >= 0)
+    {
+        writeback_start(t);
+    }
+    if (options.merge_pages > 0)
+    {
+        merge_start(t);
+    }
+
+    // Run the specified program
+    run_program(t, program, program_mt);
+    merge_finish(t);
+    writeback_finish(t);
+    events_finish();
+    std::cout << "Total page faults: " << t->total_page_faults << endl;
+    std::cout << "Total disk writes: " << t->total_disk_writes << endl;
+    std::cout << "Total disk reads: " << t->total_disk_reads << endl;
+    std::cout << "Total minor faults: " << t->total_minor_faults << endl;
+    if (options.writeback_ratio >= 0) {
+        std::cout << "Total background writebacks: " << t->total_writebacks << endl;
+    }
+    if (options.evict_cluster > 1) {
+        std::cout << "Total pages cleaned with an eviction: " << t->total_cleaned << endl;
+    }
+    if (options.fault_around > 1) {
+        std::cout << "Total pages faulted around: " << t->total_fault_around << endl;
+    }
+    if (options.readahead_limit > 0) {
+        std::cout << "Total pages read ahead: " << t->total_readahead
+                  << " (window hits: " << t->total_readahead_hits << ")" << endl;
+    }
+    if (options.merge_pages > 0) {
+        std::cout << "Total pages merged: " << t->total_merged << ", copied again on write: "
+                  << t->total_unshared << endl;
+    }
+    swap_stats z = swap_get_stats(t->swap);
+    std::cout << "Total same-filled pages stored: " << z.filled << ", faults filled without the disk: "
+              << z.filled_reads << endl;
+    std::cout << "Total swap blocks moved by compaction: " << z.compacted << " (" << z.compact_reads
+              << " read), not in the disk totals" << endl;
+    if (options.zswap_pages >= 0) {
+        std::cout << "Total pages compressed into the swap pool: " << z.stored << " (" << z.rejected
+                  << " didn't compress), read back: " << z.pool_reads << ", pushed out to disk: "
+                  << z.written_back << endl;
+        if (z.pool_pages > 0) {
+            std::cout << "Swap pool holds " << z.pool_pages << " pages in " << z.pool_bytes << " bytes ("
+                      << (double)z.pool_pages * PAGE_SIZE / z.pool_bytes << "x)" << endl;
+        }
+    }
+
+    std::cout << "algoithm: " << algorithm << endl;
+    std::cout << "program: " << program_name << endl;
+    std::cout << endl << endl;
+
+    for (int phase = 0; phase < NPHASES; phase++) {
+        run_latency[phase] = latency_summarize(t->stats.phases[phase]);
+    }
+    if (options.stats_file) {
+        std::ofstream stats(options.stats_file);
+        if (!stats.is_open()) {
+            cerr << "ERROR: Couldn't write " << options.stats_file << endl;
+            exit(1);
+        }
+        stats << "npages,nframes,algorithm,program,seed,rep," << latency_header << endl;
+        write_latency_rows(stats, std::to_string(npages) + "," + std::to_string(nframes) + "," + algorithm +
+                                      "," + program_name + "," + std::to_string(options.seed) + ",0,",
+                           run_latency);
+    }
+
+    vector<int> result = { t->total_page_faults, t->total_disk_writes, t->total_disk_reads };
+    tenants.clear();
+    tenant_delete(t);
+    return result;
+}
+
+// Run the program in "ntenants" address spaces of "npages" pages at once,
+// one thread each, all sharing "nframes" frames. Each tenant may hold up to
+// options.quota frames (by default an equal share, or all of them with
+// global replacement).
+void run_tenants(int ntenants, int npages, int nframes, const char *algorithm, const char *program_name) {
+    int quota = options.quota;
+    if (quota == 0) {
+        quota = options.global_replacement ? nframes : nframes / ntenants;
+    }
+    if (quota < 1 || quota > nframes) {
+        cerr << "ERROR: Quota must be between 1 and " << nframes << " frames" << endl;
+        exit(1);
+    }
+    if (!options.global_replacement && (long)quota * ntenants > nframes) {
+        // A tenant within its quota could find memory full, and only evicts its own pages
+        cerr << "ERROR: Quotas exceed " << nframes << " frames, allow that with --global-replacement" << endl;
+        exit(1);
+    }
+
+    program_f program;
+    program_mt_f program_mt;
+    select_program(program_name, quota, program, program_mt);
+
+    frame_pool_init(free_frames, nframes);
+    events_start();
+    for (int i = 0; i < ntenants; i++) {
+        tenants.push_back(tenant_create(i, npages, nframes, quota, algorithm));
+    }
+
+    vector<std::thread> threads;
+    for (vm_tenant *t : tenants) {
+        if (options.writeback_ratio >= 0) {
+            writeback_start(t);
+        }
+        if (options.merge_pages > 0) {
+            merge_start(t);
+        }
+        threads.emplace_back(run_program, t, program, program_mt);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    std::cout << "tenant,frames,pagefaults,diskwrites,diskreads" << endl;
+    int faults = 0, writes = 0, reads = 0;
+    for (vm_tenant *t : tenants) {
+        merge_finish(t);
+        writeback_finish(t);
+    }
+    events_finish();
+    for (vm_tenant *t : tenants) {
+        std::cout << t->id << "," << t->frames << "," << t->total_page_faults << ","
+                  << t->total_disk_writes << "," << t->total_disk_reads << endl;
+        faults += t->total_page_faults;
+        writes += t->total_disk_writes;
+        reads += t->total_disk_reads;
+    }
+    std::cout << "total," << nframes - free_frames.nfree << "," << faults << "," << writes << "," << reads << endl;
+
+    for (vm_tenant *t : tenants) {
+        tenant_delete(t);
+    }
+    tenants.clear();
+}
+
+// Time the touch program on every page table backend. Nearly every access
+// is a hard fault, so elapsed time per fault is the cost of one fault.
+void benchmark_backends(int npages, int nframes, const char *algorithm) {
+    double ns_per_fault[nbackends];
+    for (int b = 0; b < nbackends; b++) {
+        options.backend = (page_table_backend)b;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        vector<int> result = mainfunc(npages, nframes, algorithm, "touch");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        ns_per_fault[b] = ns / max(1, result[0]);
+    }
+
+    std::cout << "backend,npages,nframes,algorithm,ns_per_fault" << endl;
+    for (int b = 0; b < nbackends; b++) {
+        std::cout << backend_names[b] << "," << npages << "," << nframes << "," << algorithm << ","
+                  << (long)ns_per_fault[b] << endl;
+    }
+}
+
+// Recording a trace. Every page has a frame of its own, so pages can come and
+// go without disk I/O, but only one is mapped at a time: every move to another
+// page faults and is recorded. An access that straddles two pages (an
+// unaligned copy in qsort) needs both at once, or it would fault forever. It
+// shows up as one instruction faulting in turn on the access's first byte and
+// the start of the next page. The fourth such load is recorded as a straddle,
+// and the two pages then stay mapped together until the next load of another
+// page. Separate loads of two nearby bytes can alternate the same way, but
+// not all four from the same instruction. A page that was written is checked
+// when it is unmapped, for the TRACE_FILLED of its write.
+struct trace_recorder {
+    struct trace *trace;
+    int mapped[2];   // resident pages, -1 if none
+    long written[2]; // the write of each of them since it was mapped, -1 if none
+    char *loads[3];  // addresses of the last three loads, most recent first
+    void *ips[3];    // and the instructions that made them
+};
+trace_recorder recorder;
+
+void record_fault_handler(struct page_table *pt, int page) {
+    trace_recorder &r = recorder;
+    if (pt->page_bits[page] == PROT_READ) {
+        r.written[r.mapped[0] == page ? 0 : 1] = trace_append(r.trace, page, TRACE_WRITE);
+        page_table_set_entry(pt, page, page, PROT_READ | PROT_WRITE);
+        return;
+    }
+
+    char *address = page_table_fault_address(pt);
+    void *ip = page_table_fault_ip(pt);
+    int last_page = r.loads[0] ? (r.loads[0] - pt->virtmem) / PAGE_SIZE : -1;
+    char *high = max(address, r.loads[0]);
+    bool straddle = r.mapped[1] < 0 && r.mapped[0] == last_page && last_page != page &&
+                    address == r.loads[1] && r.loads[0] == r.loads[2] &&
+                    ip == r.ips[0] && ip == r.ips[1] && ip == r.ips[2] &&
+                    (high - pt->virtmem) % PAGE_SIZE == 0;
+    trace_append(r.trace, page, straddle ? TRACE_STRADDLE : 0);
+    if (straddle) {
+        r.mapped[1] = page;
+    } else {
+        for (int i = 0; i < 2; i++) {
+            if (r.mapped[i] < 0) {
+                continue;
+            }
+            if (r.written[i] >= 0 && swap_page_filled(pt->physmem + r.mapped[i] * PAGE_SIZE)) {
+                trace_add_flags(r.trace, r.written[i], TRACE_FILLED);
+            }
+            page_table_set_entry(pt, r.mapped[i], r.mapped[i], PROT_NONE);
+            r.mapped[i] = -1;
+            r.written[i] = -1;
+        }
+        r.mapped[0] = page;
+    }
+    page_table_set_entry(pt, page, page, PROT_READ);
+    r.loads[2] = r.loads[1];
+    r.loads[1] = r.loads[0];
+    r.loads[0] = address;
+    r.ips[2] = r.ips[1];
+    r.ips[1] = r.ips[0];
+    r.ips[0] = ip;
+}
+
+// Run "program_name" on "npages" pages and return its page references
+struct trace *record_program(int npages, const char *program_name) {
+    program_f program;
+    program_mt_f program_mt;
+    select_program(program_name, 2, program, program_mt);
+    if (!program) {
+        cerr << "ERROR: Can't record a multi-threaded program" << endl;
+        exit(1);
+    }
+
+    recorder = { trace_create(npages), { -1, -1 }, { -1, -1 }, { 0, 0, 0 }, { 0, 0, 0 } };
+    // The exact fault address and instruction tell a straddling access from
+    // two accesses in turn, the userfaultfd backends only give the page
+    struct page_table *pt = page_table_create_backend(npages, npages, record_fault_handler, PAGE_TABLE_MMAP);
+    if (!pt) {
+        cerr << "ERROR: Couldn't create page table: " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    program_seed = options.seed;
+    program(page_table_get_virtmem(pt), npages * PAGE_SIZE);
+    page_table_delete(pt);
+    return recorder.trace;
+}
+
+// Run "program_name" on "npages" pages and save its page references to "filename"
+void record_trace(int npages, const char *program_name, const char *filename) {
+    struct trace *tr = record_program(npages, program_name);
+    if (!trace_save(tr, filename)) {
+        cerr << "ERROR: Couldn't write " << filename << endl;
+        exit(1);
+    }
+    std::cout << "Recorded " << trace_length(tr) << " references to " << npages
+              << " pages in " << filename << endl;
+    trace_delete(tr);
+}
+
+// Replay the trace in "filename" with "nframes" frames and the policy called
+// "algorithm", and print the counts a live run would have
+void replay(const char *filename, int nframes, const char *algorithm) {
+    struct trace *tr = trace_load(filename);
+    if (!tr) {
+        cerr << "ERROR: Couldn't read trace " << filename << endl;
+        exit(1);
+    }
+    if (nframes < 2) {
+        // A trace doesn't say which references straddle two pages
+        cerr << "ERROR: nFrames >= 2 to replay a trace" << endl;
+        exit(1);
+    }
+    int npages = trace_npages(tr);
+    eviction_policy *policy = eviction_policy_create(algorithm, npages, nframes, 0, options.seed);
+    replay_f replay_policy = select_replay(algorithm);
+    if (!policy || !replay_policy) {
+        cerr << "ERROR: Unknown algorithm: " << algorithm << endl;
+        exit(1);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    replay_result result;
+    if (!replay_policy(tr, policy, nframes, result)) {
+        cerr << "ERROR: Trace " << filename << " refers to pages beyond " << npages << endl;
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    std::cout << "Total page faults: " << result.page_faults << endl;
+    std::cout << "Total disk writes: " << result.disk_writes << endl;
+    std::cout << "Total disk reads: " << result.disk_reads << endl;
+    std::cout << "Replayed " << trace_length(tr) << " references in " << ms << " ms" << endl;
+    delete policy;
+    trace_delete(tr);
+}
+
+// Print the page faults and disk writes of LRU with every number of frames,
+// from one pass over the references of "program_name" (recorded first) or of
+// the trace in "filename", as rows of outputs/output.csv. The frames are those
+// of --frames, 2 to npages by default.
+void miss_curve_sweep(int npages, const char *program_name, const char *filename) {
+    struct trace *tr;
+    std::string name;
+    if (filename) {
+        tr = trace_load(filename);
+        if (!tr) {
+            cerr << "ERROR: Couldn't read trace " << filename << endl;
+            exit(1);
+        }
+        // Name the program after the file, "traces/sort.trace" is "sort"
+        name = filename;
+        name = name.substr(name.find_last_of('/') + 1);
+        name = name.substr(0, name.find('.'));
+        npages = trace_npages(tr);
+    } else {
+        // The program's own messages go to stderr, stdout is only the CSV
+        std::streambuf *out = std::cout.rdbuf(std::cerr.rdbuf());
+        tr = record_program(npages, program_name);
+        std::cout.rdbuf(out);
+        name = program_name;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    miss_curve curve;
+    if (!lru_miss_curve(tr, options.sample_rate, curve)) {
+        cerr << "ERROR: Trace " << filename << " refers to pages beyond " << npages << endl;
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    if (grid.frames.empty()) {
+        // Fewer frames than 2 can't hold both pages of a straddling access
+        grid.frames = parse_int_list("--frames", ("2:" + std::to_string(max(2, npages))).c_str());
+    }
+    std::ofstream file;
+    if (grid.csv) {
+        file.open("outputs/output.csv");
+        if (!file.is_open()) {
+            cerr << "ERROR: Couldn't open outputs/output.csv" << endl;
+            exit(1);
+        }
+    }
+    std::ostream &csv = grid.csv ? file : std::cout;
+    csv << "npages,nframes,algorithm,program,pagefaults,diskwrites,diskreads" << endl;
+    for (int nframes : grid.frames) {
+        int n = min(nframes, npages);
+        csv << npages << "," << nframes << ",lru-stack," << name << "," << lround(curve.page_faults[n]) << ","
+            << lround(curve.disk_writes[n]) << "," << lround(curve.disk_reads[n]) << endl;
+    }
+    cerr << "Analysed " << trace_length(tr) << " references in " << ms << " ms" << endl;
+    trace_delete(tr);
+}
+
+// One run of the batch sweep
+struct batch_config {
+    int npages;
+    int nframes;
+    const char *algorithm;
+    const char *program;
+    int seed;
+    int rep;
+};
+
+// What a run measured, "ok" is false if it failed
+struct batch_result {
+    bool ok;
+    long pagefaults;
+    long diskwrites;
+    long diskreads;
+    long elapsed_us;
+    latency_summary latency[NPHASES];
+};
+
+const int nmetrics = 4;
+const char *const metric_names[nmetrics] = { "pagefaults", "diskwrites", "diskreads", "elapsed_us" };
+
+long batch_metric(const batch_result &r, int m) {
+    const long values[nmetrics] = { r.pagefaults, r.diskwrites, r.diskreads, r.elapsed_us };
+    return values[m];
+}
+
+// A running batch worker, reporting its result through "fd"
+struct batch_worker {
+    pid_t pid;
+    int fd;
+    int index;
+};
+
+// Fork a worker that runs "config" on its own disk and physical memory and
+// writes its batch_result to a pipe. Its program output is discarded, the
+// pipe is all the parent reads. Exits on errors.
+batch_worker batch_start(const batch_config &config, int index) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        cerr << "ERROR: Couldn't create pipe: " << strerror(errno) << endl;
+        exit(1);
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        cerr << "ERROR: Couldn't fork: " << strerror(errno) << endl;
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+        disk_name = "myvirtualdisk.batch." + std::to_string(getpid());
+        options.seed = config.seed;
+        options.events_file = nullptr;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        vector<int> counts = mainfunc(config.npages, config.nframes, config.algorithm, config.program);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        unlink(disk_name.c_str());
+        batch_result result = { true, counts[0], counts[1], counts[2],
+                                (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000 };
+        std::copy(run_latency, run_latency + NPHASES, result.latency);
+        bool ok = write(fds[1], &result, sizeof(result)) == sizeof(result);
+        std::cout.flush();
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    return { pid, fds[0], index };
+}
+
+// Write the successful runs to "filename" column by column, so that a reader
+// can load one metric for the whole sweep in one go:
+//   "VMSWEEP1", uint32 rows, uint32 columns, then for every column its name
+//   (NUL terminated), a uint8 type and the rows:
+//   type 0: int64 per row
+//   type 1: uint32 count of strings, the strings (NUL terminated), and a
+//           uint32 per row indexing them
+// All numbers are in the byte order of the machine that ran the sweep.
+bool write_sweep_columns(const char *filename, const vector<batch_config> &configs,
+                         const vector<batch_result> &results) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    vector<int> rows;
+    for (size_t i = 0; i < configs.size(); i++) {
+        if (results[i].ok) {
+            rows.push_back(i);
+        }
+    }
+    auto put32 = [&](uint32_t v) { file.write((const char *)&v, sizeof(v)); };
+    auto put_string = [&](const char *name) { file.write(name, strlen(name) + 1); };
+    auto put_ints = [&](const char *name, auto value) {
+        put_string(name);
+        file.put(0);
+        for (int i : rows) {
+            int64_t v = value(i);
+            file.write((const char *)&v, sizeof(v));
+        }
+    };
+    auto put_strings = [&](const char *name, auto value) {
+        vector<const char *> strings;
+        vector<uint32_t> codes;
+        for (int i : rows) {
+            const char *v = value(i);
+            size_t code = 0;
+            while (code < strings.size() && strcmp(strings[code], v) != 0) {
+                code++;
+            }
+            if (code == strings.size()) {
+                strings.push_back(v);
+            }
+            codes.push_back(code);
+        }
+        put_string(name);
+        file.put(1);
+        put32(strings.size());
+        for (const char *v : strings) {
+            put_string(v);
+        }
+        file.write((const char *)codes.data(), codes.size() * sizeof(uint32_t));
+    };
+
+    file.write("VMSWEEP1", 8);
+    put32(rows.size());
+    put32(6 + nmetrics);
+    put_ints("npages", [&](int i) { return configs[i].npages; });
+    put_ints("nframes", [&](int i) { return configs[i].nframes; });
+    put_strings("algorithm", [&](int i) { return configs[i].algorithm; });
+    put_strings("program", [&](int i) { return configs[i].program; });
+    put_ints("seed", [&](int i) { return configs[i].seed; });
+    put_ints("rep", [&](int i) { return configs[i].rep; });
+    for (int m = 0; m < nmetrics; m++) {
+        put_ints(metric_names[m], [&](int i) { return batch_metric(results[i], m); });
+    }
+    return file.good();
+}
+
+// Write the mean, standard deviation, minimum and maximum of every metric
+// over the seeds and repetitions of each configuration to "filename". The
+// runs of a configuration are next to each other in "configs".
+bool write_sweep_summary(const char *filename, const vector<batch_config> &configs,
+                         const vector<batch_result> &results, int runs_per_config) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << "npages,nframes,algorithm,program,runs";
+    for (int m = 0; m < nmetrics; m++) {
+        const char *name = metric_names[m];
+        file << "," << name << "_mean," << name << "_stddev," << name << "_min," << name << "_max";
+    }
+    file << endl;
+
+    for (size_t first = 0; first < configs.size(); first += runs_per_config) {
+        const batch_config &c = configs[first];
+        int runs = 0;
+        for (int i = 0; i < runs_per_config; i++) {
+            runs += results[first + i].ok;
+        }
+        file << c.npages << "," << c.nframes << "," << c.algorithm << "," << c.program << "," << runs;
+        for (int m = 0; m < nmetrics; m++) {
+            double sum = 0;
+            long lo = LONG_MAX, hi = LONG_MIN;
+            for (int i = 0; i < runs_per_config; i++) {
+                const batch_result &r = results[first + i];
+                if (r.ok) {
+                    long v = batch_metric(r, m);
+                    lo = min(lo, v);
+                    hi = max(hi, v);
+                    sum += v;
+                }
+            }
+            if (runs == 0) {
+                lo = hi = 0;
+            }
+            double mean = runs > 0 ? sum / runs : 0;
+            double squares = 0;
+            for (int i = 0; i < runs_per_config; i++) {
+                const batch_result &r = results[first + i];
+                if (r.ok) {
+                    double d = batch_metric(r, m) - mean;
+                    squares += d * d;
+                }
+            }
+            double stddev = runs > 1 ? sqrt(squares / (runs - 1)) : 0;
+            file << "," << mean << "," << stddev << "," << lo << "," << hi;
+        }
+        file << endl;
+    }
+    return file.good();
+}
+
+// Run every combination of the sweep grid, up to options.jobs at a time in
+// separate processes. Writes the runs to outputs/sweep.bin (and unless
+// --no-csv to outputs/output.csv, in the order of the sweep whatever order
+// they finish in) and their statistics over seeds and repetitions to
+// outputs/summary.csv.
+// The fault latencies of every run go next to the CSV, in outputs/stats.csv.
+void run_batch() {
+    // The defaults are the original sweep
+    if (grid.npages.empty()) {
+        grid.npages = { 100 };
+    }
+    if (grid.frames.empty()) {
+        grid.frames = parse_int_list("--frames", "5:95:5");
+    }
+    if (grid.algorithms.empty()) {
+        grid.algorithms = { "rand", "fifo", "custom" };
+    }
+    if (grid.programs.empty()) {
+        grid.programs = { "sort", "scan", "focus" };
+    }
+    if (grid.seeds.empty()) {
+        grid.seeds = { (int)options.seed };
+    }
+
+    // Check the names here rather than in every worker
+    for (const std::string &algorithm : grid.algorithms) {
+        eviction_policy *policy = eviction_policy_create(algorithm.c_str(), 1, 1);
+        if (!policy) {
+            cerr << "ERROR: Unknown algorithm: " << algorithm << endl;
+            exit(1);
+        }
+        delete policy;
+    }
+    for (const std::string &program_name : grid.programs) {
+        program_f program;
+        program_mt_f program_mt;
+        select_program(program_name.c_str(), 2, program, program_mt);
+    }
+
+    vector<batch_config> configs;
+    for (int npages : grid.npages) {
+        for (int nframes : grid.frames) {
+            for (const std::string &program_name : grid.programs) {
+                for (const std::string &algorithm : grid.algorithms) {
+                    for (int seed : grid.seeds) {
+                        for (int rep = 0; rep < grid.repeat; rep++) {
+                            configs.push_back({ npages, nframes, algorithm.c_str(), program_name.c_str(), seed, rep });
+                        }
+                    }
+                }
+            }
+        }
+    }
+    int runs_per_config = grid.seeds.size() * grid.repeat;
+    int jobs = options.jobs > 0 ? options.jobs : max(1u, std::thread::hardware_concurrency());
+
+    std::ofstream csv;
+    if (grid.csv) {
+        csv.open("outputs/output.csv");
+        if (!csv.is_open()) {
+            cerr << "ERROR: Couldn't open outputs/output.csv" << endl;
+            exit(1);
+        }
+        // graph.py reads only the first seven columns (usecols=range(7)), new
+        // ones go after them
+        csv << "npages,nframes,algorithm,program,pagefaults,diskwrites,diskreads,seed,rep,elapsed_us" << endl;
+    }
+    // The fault latencies go next to the CSV, or where --stats says. The
+    // workers send them back rather than writing the file themselves.
+    const char *stats_file = options.stats_file ? options.stats_file : grid.csv ? "outputs/stats.csv" : nullptr;
+    options.stats_file = nullptr;
+    std::ofstream stats;
+    if (stats_file) {
+        stats.open(stats_file);
+        if (!stats.is_open()) {
+            cerr << "ERROR: Couldn't open " << stats_file << endl;
+            exit(1);
+        }
+        stats << "npages,nframes,algorithm,program,seed,rep," << latency_header << endl;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    vector<batch_result> results(configs.size());
+    vector<char> done(configs.size(), 0);
+    vector<batch_worker> workers;
+    vector<struct pollfd> fds;
+    int next_start = 0;
+    int next_write = 0;
+    int failures = 0;
+    while (next_write < (int)configs.size()) {
+        while (next_start < (int)configs.size() && (int)workers.size() < jobs) {
+            workers.push_back(batch_start(configs[next_start], next_start));
+            next_start++;
+        }
+
+        fds.resize(workers.size());
+        for (size_t i = 0; i < workers.size(); i++) {
+            fds[i] = { workers[i].fd, POLLIN, 0 };
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "ERROR: poll failed: " << strerror(errno) << endl;
+            exit(1);
+        }
+        for (size_t i = fds.size(); i-- > 0;) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            batch_worker w = workers[i];
+            batch_result result;
+            bool ok = read(w.fd, &result, sizeof(result)) == sizeof(result);
+            close(w.fd);
+            int status;
+            waitpid(w.pid, &status, 0);
+            if (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                results[w.index] = result;
+            } else {
+                const batch_config &c = configs[w.index];
+                cerr << "ERROR: Batch run " << c.npages << " " << c.nframes << " " << c.algorithm
+                     << " " << c.program << " --seed=" << c.seed << " failed" << endl;
+                results[w.index].ok = false;
+                failures++;
+            }
+            done[w.index] = 1;
+            workers.erase(workers.begin() + i);
+        }
+
+        // Rows go out in sweep order, as soon as every earlier run is done
+        for (; next_write < (int)configs.size() && done[next_write]; next_write++) {
+            const batch_config &c = configs[next_write];
+            const batch_result &r = results[next_write];
+            if (grid.csv && r.ok) {
+                csv << c.npages << "," << c.nframes << "," << c.algorithm << "," << c.program << ","
+                    << r.pagefaults << "," << r.diskwrites << "," << r.diskreads << ","
+                    << c.seed << "," << c.rep << "," << r.elapsed_us << endl;
+            }
+            if (stats_file && r.ok) {
+                write_latency_rows(stats, std::to_string(c.npages) + "," + std::to_string(c.nframes) + "," +
+                                              c.algorithm + "," + c.program + "," + std::to_string(c.seed) +
+                                              "," + std::to_string(c.rep) + ",",
+                                   r.latency);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (grid.csv) {
+        csv.close();
+    }
+    if (!write_sweep_columns("outputs/sweep.bin", configs, results) ||
+        !write_sweep_summary("outputs/summary.csv", configs, results, runs_per_config)) {
+        cerr << "ERROR: Couldn't write the results to outputs" << endl;
+        exit(1);
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    std::cout << configs.size() << " runs on " << jobs << " workers in " << seconds << " s";
+    if (failures > 0) {
+        std::cout << ", " << failures << " failed";
+    }
+    std::cout << endl;
+}
+
+int main(int argc, char *argv[]) {    
+    if (argc >= 2 && argv[1] == std::string("bench")) { // usage ./virtmem bench [npages nframes algorithm] [options]
+        int first_option = argc >= 5 ? 5 : 2;
+        parse_options(argc, argv, first_option);
+        npages = argc >= 5 ? atoi(argv[2]) : 1000;
+        num_frames = argc >= 5 ? atoi(argv[3]) : 500;
+        benchmark_backends(npages, num_frames, argc >= 5 ? argv[4] : "fifo");
+    }
+    else if (argc >= 7 && argv[1] == std::string("tenants")) { // usage ./virtmem tenants <ntenants> <npages> <nframes> <algorithm> <program> [options]
+        parse_options(argc, argv, 7);
+        npages = atoi(argv[3]);
+        num_frames = atoi(argv[4]);
+        run_tenants(max(1, atoi(argv[2])), npages, num_frames, argv[5], argv[6]);
+    }
+    else if (argc >= 5 && argv[1] == std::string("record")) { // usage ./virtmem record <npages> <program> <tracefile> [options]
+        parse_options(argc, argv, 5);
+        record_trace(atoi(argv[2]), argv[3], argv[4]);
+    }
+    else if (argc >= 5 && argv[1] == std::string("replay")) { // usage ./virtmem replay <tracefile> <nframes> <algorithm> [options]
+        parse_options(argc, argv, 5);
+        replay(argv[2], atoi(argv[3]), argv[4]);
+    }
+    else if (argc >= 3 && argv[1] == std::string("curve")) { // usage ./virtmem curve <npages> <program> | <tracefile> [options]
+        bool recorded = argc >= 4 && argv[3][0] != '-';
+        parse_options(argc, argv, recorded ? 4 : 3);
+        if (recorded) {
+            miss_curve_sweep(atoi(argv[2]), argv[3], nullptr);
         } else {
+            miss_curve_sweep(0, nullptr, argv[2]);
+        }
+        if (grid.plot && system("python3 graph.py") != 0) {
             std::cerr << "Graph script failed to run.\n";
         }
     }
-}
\ No newline at end of file
+    else if (argc >= 5 && argv[1] != std::string("batch")) { // usage ./virtmem <npages> <nframes> <algorithm> <program> [options]
+        parse_options(argc, argv, 5);
+        npages = atoi(argv[1]);
+        num_frames = atoi(argv[2]);
+        const char *algorithm = argv[3];
+        const char *program_name = argv[4];
+
+        vector<int> result = mainfunc(npages, num_frames, algorithm, program_name);
+    }
+    else if (argc >= 2 && argv[1] == std::string("batch")) { // usage ./virtmem batch [options]
+        // As it always has, a batch writes outputs/output.csv and graphs it
+        grid.csv = true;
+        grid.plot = true;
+        parse_options(argc, argv, 2);
+        printflag = false;
+        std::cout << "__________BATCH MODE__________" <<endl;
+        run_batch();
+
+        // updates the graphs when finished
+        if (grid.plot) {
+            int result = system("python3 graph.py");
+
+            if (result == 0) {
+                std::cout << "Graph script ran successfully!\n";
+            } else {
+                std::cerr << "Graph script failed to run.\n";
+            }
+        }
+    }
+}
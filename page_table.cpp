@@ -5,15 +5,27 @@ Make all of your changes to main.cpp instead.
 */
 
 #include "page_table.h"
+#include "stats.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <vector>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <string.h>
 #include <ucontext.h>
 #include <unistd.h>
+#include <linux/userfaultfd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 using std::cerr;
 using std::cout;
@@ -23,10 +35,60 @@ using std::endl;
 int remap_file_pages(void *addr, size_t size, int prot,
                      size_t pgoff, int flags);
 
-struct page_table *the_page_table = 0;
+// Every page table, sorted by the address of its virtual memory, so that the
+// fault handler can find the one a faulting address belongs to. Faults take
+// the lock for reading. Registering touches no virtual memory, so a thread
+// never faults while it holds the lock for writing.
+static std::vector<struct page_table *> regions;
+static pthread_rwlock_t regions_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void region_add(struct page_table *pt)
+{
+    pthread_rwlock_wrlock(&regions_lock);
+    auto at = std::upper_bound(regions.begin(), regions.end(), pt,
+                               [](struct page_table *a, struct page_table *b) { return a->virtmem < b->virtmem; });
+    regions.insert(at, pt);
+    pthread_rwlock_unlock(&regions_lock);
+}
+
+static void region_remove(struct page_table *pt)
+{
+    pthread_rwlock_wrlock(&regions_lock);
+    regions.erase(std::find(regions.begin(), regions.end(), pt));
+    pthread_rwlock_unlock(&regions_lock);
+}
+
+// The page table whose virtual memory contains "addr", or null
+static struct page_table *region_find(char *addr)
+{
+    struct page_table *pt = 0;
+
+    pthread_rwlock_rdlock(&regions_lock);
+    auto after = std::upper_bound(regions.begin(), regions.end(), addr,
+                                  [](char *a, struct page_table *b) { return a < b->virtmem; });
+    if (after != regions.begin())
+    {
+        struct page_table *before = *(after - 1);
+        if (addr < before->virtmem + (size_t)before->npages * PAGE_SIZE)
+            pt = before;
+    }
+    pthread_rwlock_unlock(&regions_lock);
+
+    return pt;
+}
+
+// Whether the fault being handled by this thread is a write, -1 if unknown
+static thread_local int fault_write = -1;
+// and the address it faulted on
+static thread_local char *fault_address = 0;
+// and the instruction that faulted, 0 if unknown
+static thread_local void *fault_ip = 0;
+// and when the backend got it, in stats_now ticks
+static thread_local uint64_t fault_time = 0;
 
 static void internal_fault_handler(int signum, siginfo_t *info, void *context)
 {
+    uint64_t now = stats_now();
 
 #ifdef i386
     char *addr = (char *)(((struct ucontext *)context)->uc_mcontext.cr2);
@@ -34,24 +96,117 @@ static void internal_fault_handler(int signum, siginfo_t *info, void *context)
     char *addr = (char *)info->si_addr;
 #endif
 
-    struct page_table *pt = the_page_table;
+    struct page_table *pt = region_find(addr);
 
     if (pt)
     {
         int page = (addr - pt->virtmem) / PAGE_SIZE;
+        fault_address = addr;
+        fault_time = now;
 
-        if (page >= 0 && page < pt->npages)
-        {
-            pt->handler(pt, page);
-            return;
-        }
+#if defined(__x86_64__)
+        // Bit 1 of the page fault error code is set for writes
+        fault_write = (((ucontext_t *)context)->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+        fault_ip = (void *)((ucontext_t *)context)->uc_mcontext.gregs[REG_RIP];
+#else
+        fault_write = -1;
+        fault_ip = 0;
+#endif
+        pt->handler(pt, page);
+        return;
     }
 
     cerr << "segmentation fault at address " << addr << endl;
     abort();
 }
 
+// Set up a userfaultfd for the virtual memory. Faults are reported with
+// SIGBUS, or as events to read from the descriptor if "sigbus" is false.
+static int uffd_register(struct page_table *pt, bool sigbus)
+{
+    pt->uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (pt->uffd < 0)
+        return 0;
+
+    struct uffdio_api api;
+    memset(&api, 0, sizeof(api));
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+    if (sigbus)
+        api.features |= UFFD_FEATURE_SIGBUS;
+    if (ioctl(pt->uffd, UFFDIO_API, &api) < 0)
+        return 0;
+
+    struct uffdio_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.range.start = (unsigned long)pt->virtmem;
+    reg.range.len = (unsigned long)pt->npages * PAGE_SIZE;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(pt->uffd, UFFDIO_REGISTER, &reg) < 0)
+        return 0;
+
+    return 1;
+}
+
+// PAGE_TABLE_UFFD_THREAD: serve fault events until service_stop is signalled
+static void *uffd_service_thread(void *arg)
+{
+    struct page_table *pt = (struct page_table *)arg;
+    struct pollfd fds[2];
+    struct uffd_msg msgs[16];
+
+    fds[0].fd = pt->uffd;
+    fds[0].events = POLLIN;
+    fds[1].fd = pt->service_stop;
+    fds[1].events = POLLIN;
+
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            cerr << "uffd service thread: poll failed: " << strerror(errno) << endl;
+            abort();
+        }
+        if (fds[1].revents)
+            return 0;
+
+        ssize_t n = read(pt->uffd, msgs, sizeof(msgs));
+        if (n < 0)
+            continue;
+
+        for (int i = 0; i < n / (ssize_t)sizeof(struct uffd_msg); i++)
+        {
+            if (msgs[i].event != UFFD_EVENT_PAGEFAULT)
+                continue;
+
+            char *addr = (char *)(unsigned long)msgs[i].arg.pagefault.address;
+            int page = (addr - pt->virtmem) / PAGE_SIZE;
+            fault_address = addr;
+            fault_time = stats_now();
+            fault_write = (msgs[i].arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE) != 0;
+            fault_ip = 0;
+            pt->handler(pt, page);
+
+            // The handler normally resolved the fault, which wakes the faulting
+            // thread; wake it anyway in case the page was already there
+            struct uffdio_range range;
+            range.start = (unsigned long)(pt->virtmem + page * PAGE_SIZE);
+            range.len = PAGE_SIZE;
+            ioctl(pt->uffd, UFFDIO_WAKE, &range);
+        }
+    }
+}
+
 struct page_table *page_table_create(int npages, int nframes, page_fault_handler_t handler)
+{
+    return page_table_create_backend(npages, nframes, handler, PAGE_TABLE_REMAP);
+}
+
+// Create a page table, with physical memory of its own or that of "share"
+static struct page_table *create_table(int npages, int nframes, page_fault_handler_t handler,
+                                       enum page_table_backend backend, struct page_table *share)
 {
     int i;
     struct sigaction sa;
@@ -62,24 +217,70 @@ struct page_table *page_table_create(int npages, int nframes, page_fault_handler
     if (!pt)
         return 0;
 
-    the_page_table = pt;
+    pt->backend = backend;
+    pt->handler_data = 0;
+    pt->mapped_frame = 0;
+    pt->uffd = -1;
+    pt->service_stop = -1;
+    bool uffd = backend == PAGE_TABLE_UFFD || backend == PAGE_TABLE_UFFD_THREAD;
 
-    sprintf(filename, "/tmp/pmem.%d.%d", getpid(), getuid());
+    if (share)
+    {
+        // The file must also reach as far as this virtual memory
+        struct stat st;
+        pt->fd = dup(share->fd);
+        nframes = share->nframes;
+        if (fstat(pt->fd, &st) == 0 && st.st_size < (off_t)PAGE_SIZE * npages)
+            ftruncate(pt->fd, PAGE_SIZE * npages);
+    }
+    else
+    {
+        sprintf(filename, "/tmp/pmem.%d.%d", getpid(), getuid());
 
-    pt->fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, 0777);
-    if (!pt->fd)
-        return 0;
+        pt->fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, 0777);
+        if (!pt->fd)
+            return 0;
 
-    ftruncate(pt->fd, PAGE_SIZE * npages);
+        ftruncate(pt->fd, PAGE_SIZE * npages);
 
-    unlink(filename);
+        unlink(filename);
+    }
 
     pt->physmem = (char *)mmap(0, nframes * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, pt->fd, 0);
     pt->nframes = nframes;
 
-    pt->virtmem = (char *)mmap(0, npages * PAGE_SIZE, PROT_NONE, MAP_SHARED | MAP_NORESERVE, pt->fd, 0);
+    if (uffd)
+    {
+        pt->virtmem = (char *)mmap(0, npages * PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    else
+    {
+        pt->virtmem = (char *)mmap(0, npages * PAGE_SIZE, PROT_NONE, MAP_SHARED | MAP_NORESERVE, pt->fd, 0);
+    }
     pt->npages = npages;
 
+    if (uffd && !uffd_register(pt, backend == PAGE_TABLE_UFFD))
+    {
+        if (pt->uffd >= 0)
+            close(pt->uffd);
+        munmap(pt->virtmem, npages * PAGE_SIZE);
+        munmap(pt->physmem, nframes * PAGE_SIZE);
+        close(pt->fd);
+        delete pt;
+        return 0;
+    }
+
+    if (backend == PAGE_TABLE_MMAP)
+    {
+        // The initial mapping puts page i at offset i of the file, which is frame i
+        pt->mapped_frame = new int[npages];
+        for (i = 0; i < npages; i++)
+        {
+            pt->mapped_frame[i] = i;
+        }
+    }
+
     pt->page_bits = new int[npages];
     for (i = 0; i < npages; i++)
     {
@@ -92,6 +293,12 @@ struct page_table *page_table_create(int npages, int nframes, page_fault_handler
         pt->page_mapping[i] = 0;
     }
 
+    pt->frame_mapping = new int[nframes];
+    for (i = 0; i < nframes; i++)
+    {
+        pt->frame_mapping[i] = -1;
+    }
+
     pt->handler = handler;
 
     for (i = 0; i < pt->npages; i++)
@@ -102,20 +309,194 @@ struct page_table *page_table_create(int npages, int nframes, page_fault_handler
 
     sigfillset(&sa.sa_mask);
     sigaction(SIGSEGV, &sa, 0);
+    if (backend == PAGE_TABLE_UFFD)
+        sigaction(SIGBUS, &sa, 0);
+
+    if (backend == PAGE_TABLE_UFFD_THREAD)
+    {
+        pthread_t thread;
+        pt->service_stop = eventfd(0, EFD_CLOEXEC);
+        if (pt->service_stop < 0 || pthread_create(&thread, 0, uffd_service_thread, pt) != 0)
+        {
+            cerr << "page_table_create: couldn't start the fault service thread" << endl;
+            abort();
+        }
+        pt->service_thread = thread;
+    }
 
+    region_add(pt);
     return pt;
 }
 
+struct page_table *page_table_create_backend(int npages, int nframes, page_fault_handler_t handler,
+                                             enum page_table_backend backend)
+{
+    return create_table(npages, nframes, handler, backend, 0);
+}
+
+struct page_table *page_table_create_shared(int npages, struct page_table *share, page_fault_handler_t handler,
+                                            enum page_table_backend backend)
+{
+    return create_table(npages, share->nframes, handler, backend, share);
+}
+
 void page_table_delete(struct page_table *pt)
 {
+    region_remove(pt);
+
+    if (pt->service_stop >= 0)
+    {
+        uint64_t one = 1;
+        write(pt->service_stop, &one, sizeof(one));
+        pthread_join((pthread_t)pt->service_thread, 0);
+        close(pt->service_stop);
+    }
+
     munmap(pt->virtmem, pt->npages * PAGE_SIZE);
     munmap(pt->physmem, pt->nframes * PAGE_SIZE);
     delete[] pt->page_bits;
     delete[] pt->page_mapping;
+    delete[] pt->frame_mapping;
+    delete[] pt->mapped_frame;
+    if (pt->uffd >= 0)
+        close(pt->uffd);
     close(pt->fd);
     delete pt;
 }
 
+// Update the page and inverted tables for one entry
+static void update_entry(struct page_table *pt, int page, int frame, int bits)
+{
+    // Release the frame this page held before, unless it has been handed over already
+    int old_frame = pt->page_mapping[page];
+    if (pt->page_bits[page] != PROT_NONE && pt->frame_mapping[old_frame] == page)
+    {
+        pt->frame_mapping[old_frame] = -1;
+    }
+    if (bits != PROT_NONE)
+    {
+        pt->frame_mapping[frame] = page;
+    }
+
+    pt->page_mapping[page] = frame;
+    pt->page_bits[page] = bits;
+}
+
+static void uffd_write_protect(struct page_table *pt, char *addr, bool protect)
+{
+    struct uffdio_writeprotect wp;
+    wp.range.start = (unsigned long)addr;
+    wp.range.len = PAGE_SIZE;
+    wp.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    if (ioctl(pt->uffd, UFFDIO_WRITEPROTECT, &wp) < 0)
+    {
+        cerr << "page_table_set_entry: UFFDIO_WRITEPROTECT failed at " << (void *)addr << endl;
+        abort();
+    }
+}
+
+// PAGE_TABLE_UFFD: move one page between the states missing (PROT_NONE),
+// write protected copy (PROT_READ) and writable copy (PROT_READ|PROT_WRITE).
+// A writable page is write protected before it is copied back to its frame,
+// so that a write by another thread can't slip in after the copy and be lost
+static void uffd_map_page(struct page_table *pt, int page, int frame, int bits)
+{
+    char *addr = pt->virtmem + page * PAGE_SIZE;
+    int old_bits = pt->page_bits[page];
+    int old_frame = pt->page_mapping[page];
+
+    if (old_bits != PROT_NONE && (bits == PROT_NONE || frame != old_frame))
+    {
+        // Leaving its frame: save what was written, then drop the copy
+        if (old_bits & PROT_WRITE)
+        {
+            uffd_write_protect(pt, addr, true);
+            memcpy(pt->physmem + old_frame * PAGE_SIZE, addr, PAGE_SIZE);
+        }
+        madvise(addr, PAGE_SIZE, MADV_DONTNEED);
+        old_bits = PROT_NONE;
+    }
+
+    if (bits == PROT_NONE)
+        return;
+
+    if (old_bits == PROT_NONE)
+    {
+        struct uffdio_copy copy;
+        copy.dst = (unsigned long)addr;
+        copy.src = (unsigned long)(pt->physmem + frame * PAGE_SIZE);
+        copy.len = PAGE_SIZE;
+        copy.mode = (bits & PROT_WRITE) ? 0 : UFFDIO_COPY_MODE_WP;
+        copy.copy = 0;
+        if (ioctl(pt->uffd, UFFDIO_COPY, &copy) < 0)
+        {
+            cerr << "page_table_set_entry: UFFDIO_COPY failed for page #" << page << endl;
+            abort();
+        }
+    }
+    else if ((old_bits & PROT_WRITE) != (bits & PROT_WRITE))
+    {
+        uffd_write_protect(pt, addr, !(bits & PROT_WRITE));
+        if (old_bits & PROT_WRITE)
+            memcpy(pt->physmem + frame * PAGE_SIZE, addr, PAGE_SIZE);
+    }
+}
+
+// Point "count" pages starting at "page" at "frames" with "bits", using the
+// table's backend, then update the tables
+static void map_pages(struct page_table *pt, int page, const int *frames, int count, int bits)
+{
+    int i;
+    int start = 0;
+
+    switch (pt->backend)
+    {
+    case PAGE_TABLE_REMAP:
+        for (i = 1; i <= count; i++)
+        {
+            if (i == count || frames[i] != frames[i - 1] + 1)
+            {
+                remap_file_pages(pt->virtmem + (page + start) * PAGE_SIZE, (i - start) * PAGE_SIZE, 0, frames[start], 0);
+                start = i;
+            }
+        }
+        mprotect(pt->virtmem + page * PAGE_SIZE, count * PAGE_SIZE, bits);
+        break;
+
+    case PAGE_TABLE_MMAP:
+        for (i = 1; i <= count; i++)
+        {
+            if (i == count || frames[i] != frames[i - 1] + 1)
+            {
+                char *addr = pt->virtmem + (page + start) * PAGE_SIZE;
+                if (i - start == 1 && pt->mapped_frame[page + start] == frames[start])
+                {
+                    // Already there, only the protection changes
+                    mprotect(addr, PAGE_SIZE, bits);
+                }
+                else
+                {
+                    mmap(addr, (i - start) * PAGE_SIZE, bits, MAP_SHARED | MAP_FIXED, pt->fd,
+                         (off_t)frames[start] * PAGE_SIZE);
+                    for (int j = start; j < i; j++)
+                        pt->mapped_frame[page + j] = frames[j];
+                }
+                start = i;
+            }
+        }
+        break;
+
+    case PAGE_TABLE_UFFD:
+    case PAGE_TABLE_UFFD_THREAD:
+        for (i = 0; i < count; i++)
+            uffd_map_page(pt, page + i, frames[i], bits);
+        break;
+    }
+
+    for (i = 0; i < count; i++)
+        update_entry(pt, page + i, frames[i], bits);
+}
+
 void page_table_set_entry(struct page_table *pt, int page, int frame, int bits)
 {
     if (page < 0 || page >= pt->npages)
@@ -134,11 +515,48 @@ void page_table_set_entry(struct page_table *pt, int page, int frame, int bits)
         abort();
     }
 
-    pt->page_mapping[page] = frame;
-    pt->page_bits[page] = bits;
+    map_pages(pt, page, &frame, 1, bits);
+}
+
+void page_table_set_entries(struct page_table *pt, int page, const int *frames, int count, int bits)
+{
+    int i;
+
+    if (page < 0 || count < 0 || page + count > pt->npages)
+    {
+        cerr << "page_table_set_entries: illegal pages #" << page << "-" << page + count - 1 << endl;
+        abort();
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (frames[i] < 0 || frames[i] >= pt->nframes)
+        {
+            cerr << "page_table_set_entries: illegal frame #" << frames[i] << endl;
+            abort();
+        }
+    }
 
-    remap_file_pages(pt->virtmem + page * PAGE_SIZE, PAGE_SIZE, 0, frame, 0);
-    mprotect(pt->virtmem + page * PAGE_SIZE, PAGE_SIZE, bits);
+    map_pages(pt, page, frames, count, bits);
+}
+
+void page_table_share_entry(struct page_table *pt, int page, int frame)
+{
+    if (page < 0 || page >= pt->npages)
+    {
+        cerr << "page_table_share_entry: illegal page #" << page << endl;
+        abort();
+    }
+
+    if (frame < 0 || frame >= pt->nframes)
+    {
+        cerr << "page_table_share_entry: illegal frame #" << frame << endl;
+        abort();
+    }
+
+    int holder = pt->frame_mapping[frame];
+    map_pages(pt, page, &frame, 1, PROT_READ);
+    pt->frame_mapping[frame] = holder;
 }
 
 void page_table_get_entry(struct page_table *pt, int page, int *frame, int *bits)
@@ -153,6 +571,28 @@ void page_table_get_entry(struct page_table *pt, int page, int *frame, int *bits
     *bits = pt->page_bits[page];
 }
 
+struct page_table_entry page_table_lookup(struct page_table *pt, int page)
+{
+    if (page < 0 || page >= pt->npages)
+    {
+        cerr << "page_table_lookup: illegal page #" << page << endl;
+        abort();
+    }
+
+    return { pt->page_mapping[page], pt->page_bits[page] };
+}
+
+int page_table_get_page(struct page_table *pt, int frame)
+{
+    if (frame < 0 || frame >= pt->nframes)
+    {
+        cerr << "page_table_get_page: illegal frame #" << frame << endl;
+        abort();
+    }
+
+    return pt->frame_mapping[frame];
+}
+
 void page_table_print_entry(struct page_table *pt, int page)
 {
     if (page < 0 || page >= pt->npages)
@@ -181,6 +621,36 @@ void page_table_print(struct page_table *pt)
     }
 }
 
+int page_table_fault_is_write(struct page_table *pt)
+{
+    return fault_write;
+}
+
+char *page_table_fault_address(struct page_table *pt)
+{
+    return fault_address;
+}
+
+void *page_table_fault_ip(struct page_table *pt)
+{
+    return fault_ip;
+}
+
+uint64_t page_table_fault_time(struct page_table *pt)
+{
+    return fault_time;
+}
+
+void page_table_set_handler_data(struct page_table *pt, void *data)
+{
+    pt->handler_data = data;
+}
+
+void *page_table_get_handler_data(struct page_table *pt)
+{
+    return pt->handler_data;
+}
+
 int page_table_get_nframes(struct page_table *pt)
 {
     return pt->nframes;
@@ -1,6 +1,7 @@
 #ifndef PAGE_TABLE_H
 #define PAGE_TABLE_H
 
+#include <stdint.h>
 #include <sys/mman.h>
 
 #ifndef PAGE_SIZE
@@ -11,6 +12,36 @@ struct page_table;
 
 typedef void (*page_fault_handler_t)(struct page_table *pt, int page);
 
+/*
+How virtual pages are made to show the contents of physical frames.
+PAGE_TABLE_REMAP uses remap_file_pages on one shared mapping of physical
+memory. PAGE_TABLE_MMAP maps each page with its own mmap(MAP_FIXED) over
+the physical memory file. PAGE_TABLE_UFFD registers an anonymous virtual
+memory with userfaultfd: pages are filled with UFFDIO_COPY and write
+protected with UFFDIO_WRITEPROTECT, and faults arrive as SIGBUS.
+PAGE_TABLE_UFFD_THREAD works the same way, except that no signal is used:
+a fault-service thread reads the fault events from the userfaultfd and
+calls the handler, while the faulting thread waits in the kernel. The
+handler then runs in an ordinary thread, so it may allocate, take locks
+and block, and it must not touch pages of the virtual memory that are
+not mapped.
+A woken thread only retries its access once it is scheduled again, so
+when memory is far too small for the working sets of several faulting
+threads they can evict each other's pages before using them.
+
+With the uffd backends a page is a copy of its frame, so the frame only has
+the latest data once the page is mapped without PROT_WRITE. Make a dirty
+page read-only or PROT_NONE before writing its frame to disk.
+*/
+
+enum page_table_backend
+{
+    PAGE_TABLE_REMAP,
+    PAGE_TABLE_MMAP,
+    PAGE_TABLE_UFFD,
+    PAGE_TABLE_UFFD_THREAD
+};
+
 struct page_table
 {
     int fd;
@@ -20,7 +51,14 @@ struct page_table
     int nframes;
     int *page_mapping;
     int *page_bits;
+    int *frame_mapping; // inverted table: page held by each frame, or -1
     page_fault_handler_t handler;
+    void *handler_data;
+    enum page_table_backend backend;
+    int *mapped_frame; // PAGE_TABLE_MMAP: frame currently mmapped at each page
+    int uffd;          // uffd backends: the userfaultfd, otherwise -1
+    int service_stop;  // PAGE_TABLE_UFFD_THREAD: eventfd that stops the service thread
+    unsigned long service_thread;
 };
 
 /* Create a new page table, along with a corresponding virtual memory
@@ -29,6 +67,21 @@ that is "npages" big and a physical memory that is "nframes" big
 
 struct page_table *page_table_create(int npages, int nframes, page_fault_handler_t handler);
 
+/* Same as page_table_create, with a choice of mapping backend.
+Returns null if the backend is not available. */
+
+struct page_table *page_table_create_backend(int npages, int nframes, page_fault_handler_t handler,
+                                             enum page_table_backend backend);
+
+/* Create a page table with a new virtual memory of "npages" pages, whose
+physical memory is that of "share": frame i of either table is the same
+memory, and the caller decides which table uses which frames. Any number of
+page tables can be alive at once, the fault handler finds the right one by
+the faulting address. Returns null if the backend is not available. */
+
+struct page_table *page_table_create_shared(int npages, struct page_table *share, page_fault_handler_t handler,
+                                            enum page_table_backend backend);
+
 /* Delete a page table and the corresponding virtual and physical memories. */
 
 void page_table_delete(struct page_table *pt);
@@ -40,6 +93,23 @@ The bits may be any of PROT_READ, PROT_WRITE, or PROT_EXEC logical-ored together
 
 void page_table_set_entry(struct page_table *pt, int page, int frame, int bits);
 
+/*
+Set "count" consecutive pages starting at "page" to the frames in "frames",
+all with the same access bits. Runs of consecutive frames are remapped with
+a single call, and the bits of the whole range are set with one mprotect.
+*/
+
+void page_table_set_entries(struct page_table *pt, int page, const int *frames, int count, int bits);
+
+/*
+Map "page" read-only to "frame", which another page holds, without taking
+the frame over: the inverted table keeps the page that holds it. Any number
+of pages can share a frame this way, none of them may be made writable in
+it. Setting a sharing page to PROT_NONE leaves the frame to its holder.
+*/
+
+void page_table_share_entry(struct page_table *pt, int page, int frame);
+
 /*
 Get the frame number and access bits associated with a page.
 "frame" and "bits" must be pointers to integers which will be filled with the current values.
@@ -48,6 +118,65 @@ The bits may be any of PROT_READ, PROT_WRITE, or PROT_EXEC logical-ored together
 
 void page_table_get_entry(struct page_table *pt, int page, int *frame, int *bits);
 
+/*
+The same, returned by value, so that a fault handler needs no storage of
+its own to ask.
+*/
+
+struct page_table_entry
+{
+    int frame;
+    int bits;
+};
+
+struct page_table_entry page_table_lookup(struct page_table *pt, int page);
+
+/*
+Get the page currently mapped in a frame, or -1 if the frame holds no page.
+The inverted table is kept up to date by page_table_set_entry: a page mapped
+with any bits owns its frame, and a page set to PROT_NONE releases it.
+*/
+
+int page_table_get_page(struct page_table *pt, int frame);
+
+/*
+Called from a page fault handler: returns 1 if the fault it is handling was
+caused by a write, 0 if by a read, or -1 if the platform doesn't say. Each
+thread that handles faults gets the answer for its own fault.
+*/
+
+int page_table_fault_is_write(struct page_table *pt);
+
+/*
+Called from a page fault handler: returns the address of the fault it is
+handling. With userfaultfd events it is only the start of the page.
+*/
+
+char *page_table_fault_address(struct page_table *pt);
+
+/*
+Called from a page fault handler: returns the address of the instruction
+that faulted, or 0 if the backend doesn't say, as with userfaultfd events.
+*/
+
+void *page_table_fault_ip(struct page_table *pt);
+
+/*
+Called from a page fault handler: returns when the backend got the fault
+it is handling, in stats_now ticks (see stats.h).
+*/
+
+uint64_t page_table_fault_time(struct page_table *pt);
+
+/* Attach a pointer of the caller's choosing to a page table, so that a fault
+handler shared by several page tables can find the state of each. */
+
+void page_table_set_handler_data(struct page_table *pt, void *data);
+
+/* Get the pointer set with page_table_set_handler_data, null by default. */
+
+void *page_table_get_handler_data(struct page_table *pt);
+
 /* Return a pointer to the start of the virtual memory associated with a page table. */
 
 char *page_table_get_virtmem(struct page_table *pt);
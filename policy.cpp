@@ -0,0 +1,637 @@
+#include "policy.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string.h>
+
+using std::max;
+using std::min;
+
+#define POLICY_NAME(policy_name, type, args) policy_name,
+
+const char *const eviction_policy_names[] = { EVICTION_POLICIES(POLICY_NAME) nullptr };
+
+#define POLICY_CREATE(policy_name, type, args) \
+    if (!strcmp(name, policy_name)) {          \
+        return new type args;                  \
+    }
+
+eviction_policy *eviction_policy_create(const char *name, int npages, int nframes, int capacity,
+                                        unsigned seed) {
+    // Policies over frame numbers need all of them, the others only the capacity
+    if (capacity == 0) {
+        capacity = nframes;
+    }
+    EVICTION_POLICIES(POLICY_CREATE)
+    return nullptr;
+}
+
+// page_list
+
+void page_list::init(int npages) {
+    prev.assign(npages, -1);
+    next.assign(npages, -1);
+    member.assign(npages, 0);
+    head = -1;
+    tail = -1;
+    size = 0;
+}
+
+// Append pages of "list" from the back, as frames, while there is room
+static int list_candidates(const page_list &list, const std::vector<int> &frame_of,
+                           int *frames, int count, int max) {
+    for (int page = list.back(); page >= 0 && count < max; page = list.before(page)) {
+        frames[count++] = frame_of[page];
+    }
+    return count;
+}
+
+// rand
+
+rand_policy::rand_policy(int nframes, unsigned seed) : frames(nframes), nresident(0), index_of(nframes, -1) {
+    // Spread the seed over all the bits (splitmix64), the state must not be 0
+    state = seed + 0x9e3779b97f4a7c15ULL;
+    state = (state ^ (state >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    state = (state ^ (state >> 27)) * 0x94d049bb133111ebULL;
+    state ^= state >> 31;
+    if (state == 0) {
+        state = 1;
+    }
+}
+
+void rand_policy::page_mapped(int page, int frame) {
+    if (index_of[frame] < 0) {
+        index_of[frame] = nresident;
+        frames[nresident++] = frame;
+    }
+}
+
+int rand_policy::select_victim(int page) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    // Scaled rather than reduced modulo the count, which would favour the first frames
+    int frame = frames[(unsigned __int128)(state * 0x2545f4914f6cdd1dULL) * nresident >> 64];
+    page_removed(page, frame);
+    return frame;
+}
+
+void rand_policy::page_removed(int page, int frame) {
+    // The last resident frame takes its place
+    int i = index_of[frame];
+    if (i < 0) {
+        return;
+    }
+    int last = frames[--nresident];
+    frames[i] = last;
+    index_of[last] = i;
+    index_of[frame] = -1;
+}
+
+// fifo
+
+fifo_policy::fifo_policy(int nframes) {
+    order.init(nframes);
+}
+
+void fifo_policy::page_mapped(int page, int frame) {
+    order.push_front(frame);
+}
+
+int fifo_policy::select_victim(int page) {
+    return order.pop_back();
+}
+
+void fifo_policy::page_removed(int page, int frame) {
+    order.remove(frame);
+}
+
+int fifo_policy::eviction_candidates(int *frames, int max) const {
+    int count = 0;
+    for (int frame = order.back(); frame >= 0 && count < max; frame = order.before(frame)) {
+        frames[count++] = frame;
+    }
+    return count;
+}
+
+// clock
+
+clock_policy::clock_policy(int nframes)
+    : nframes(nframes), index(0), used(nframes, 0), resident(nframes, 0) {
+}
+
+void clock_policy::page_mapped(int page, int frame) {
+    used[frame] = 0;
+    resident[frame] = 1;
+}
+
+void clock_policy::page_referenced(int page, int frame) {
+    used[frame] = 1;
+    index = (index + 1) % nframes;
+}
+
+int clock_policy::select_victim(int page) {
+    while (!resident[index] || used[index]) {
+        used[index] = 0;
+        index = (index + 1) % nframes;
+    }
+    int frame = index;
+    resident[frame] = 0;
+    index = (index + 1) % nframes;
+    return frame;
+}
+
+void clock_policy::page_removed(int page, int frame) {
+    resident[frame] = 0;
+}
+
+int clock_policy::eviction_candidates(int *frames, int max) const {
+    int count = 0;
+    for (int i = 0; i < nframes && count < max; i++) {
+        int frame = (index + i) % nframes;
+        if (resident[frame]) {
+            frames[count++] = frame;
+        }
+    }
+    return count;
+}
+
+// lru
+
+lru_policy::lru_policy(int npages) : frame_of(npages, -1) {
+    recency.init(npages);
+}
+
+void lru_policy::page_mapped(int page, int frame) {
+    frame_of[page] = frame;
+    recency.push_front(page);
+}
+
+void lru_policy::page_referenced(int page, int frame) {
+    recency.remove(page);
+    recency.push_front(page);
+}
+
+int lru_policy::select_victim(int page) {
+    return frame_of[recency.pop_back()];
+}
+
+void lru_policy::page_removed(int page, int frame) {
+    recency.remove(page);
+}
+
+int lru_policy::eviction_candidates(int *frames, int max) const {
+    return list_candidates(recency, frame_of, frames, 0, max);
+}
+
+// 2q
+
+two_queue_policy::two_queue_policy(int npages, int nframes)
+    : kin(max(1, nframes / 4)), kout(max(1, nframes / 2)), frame_of(npages, -1) {
+    a1in.init(npages);
+    a1out.init(npages);
+    am.init(npages);
+}
+
+void two_queue_policy::page_mapped(int page, int frame) {
+    frame_of[page] = frame;
+    if (a1out.contains(page)) {
+        a1out.remove(page);
+        am.push_front(page);
+    } else {
+        a1in.push_front(page);
+    }
+}
+
+void two_queue_policy::page_referenced(int page, int frame) {
+    // A second touch while still in a1in is a correlated reference, not reuse
+    if (am.contains(page)) {
+        am.remove(page);
+        am.push_front(page);
+    }
+}
+
+int two_queue_policy::select_victim(int page) {
+    int victim;
+    if (a1in.size > 0 && (a1in.size > kin || am.size == 0)) {
+        victim = a1in.pop_back();
+        a1out.push_front(victim);
+        if (a1out.size > kout) {
+            a1out.pop_back();
+        }
+    } else {
+        victim = am.pop_back();
+    }
+    return frame_of[victim];
+}
+
+void two_queue_policy::victim_busy(int page, int frame) {
+    // Back to the queue it came from, without the promotion of a ghost hit
+    if (a1out.contains(page)) {
+        a1out.remove(page);
+        a1in.push_front(page);
+    } else {
+        am.push_front(page);
+    }
+}
+
+void two_queue_policy::page_removed(int page, int frame) {
+    if (a1in.contains(page)) {
+        a1in.remove(page);
+    } else {
+        am.remove(page);
+    }
+}
+
+int two_queue_policy::eviction_candidates(int *frames, int max) const {
+    const page_list &first = a1in.size > kin || am.size == 0 ? a1in : am;
+    const page_list &second = &first == &a1in ? am : a1in;
+    int count = list_candidates(first, frame_of, frames, 0, max);
+    return list_candidates(second, frame_of, frames, count, max);
+}
+
+// arc
+
+arc_policy::arc_policy(int npages, int nframes) : c(nframes), p(0), adapted(npages, 0), frame_of(npages, -1) {
+    t1.init(npages);
+    t2.init(npages);
+    b1.init(npages);
+    b2.init(npages);
+}
+
+void arc_policy::page_mapped(int page, int frame) {
+    frame_of[page] = frame;
+    if (b1.contains(page)) {
+        b1.remove(page);
+        t2.push_front(page);
+    } else if (b2.contains(page)) {
+        b2.remove(page);
+        t2.push_front(page);
+    } else {
+        t1.push_front(page);
+        // Keep the directory within c pages of recency and 2c pages in total
+        while (t1.size + b1.size > c && b1.size > 0) {
+            b1.pop_back();
+        }
+        while (t1.size + t2.size + b1.size + b2.size > 2 * c && b2.size > 0) {
+            b2.pop_back();
+        }
+    }
+}
+
+void arc_policy::page_referenced(int page, int frame) {
+    if (t1.contains(page)) {
+        t1.remove(page);
+    } else {
+        t2.remove(page);
+    }
+    t2.push_front(page);
+}
+
+int arc_policy::select_victim(int page) {
+    // A ghost hit means that list deserved more room, adapt the target first
+    bool in_b1 = page >= 0 && b1.contains(page);
+    bool in_b2 = page >= 0 && b2.contains(page);
+    int p_before = p;
+    if (in_b1) {
+        p = min(c, p + max(b2.size / b1.size, 1));
+    } else if (in_b2) {
+        p = max(0, p - max(b1.size / b2.size, 1));
+    }
+
+    int victim;
+    if (t1.size > 0 && (t1.size > p || (in_b2 && t1.size == p) || t2.size == 0)) {
+        victim = t1.pop_back();
+        b1.push_front(victim);
+    } else {
+        victim = t2.pop_back();
+        b2.push_front(victim);
+    }
+    adapted[victim] = p - p_before;
+    return frame_of[victim];
+}
+
+void arc_policy::victim_busy(int page, int frame) {
+    // Undo this choice's adaptation of the target, the choice that succeeds keeps its own
+    p -= adapted[page];
+    if (b1.contains(page)) {
+        b1.remove(page);
+        t1.push_front(page);
+    } else {
+        b2.remove(page);
+        t2.push_front(page);
+    }
+}
+
+void arc_policy::page_removed(int page, int frame) {
+    if (t1.contains(page)) {
+        t1.remove(page);
+    } else {
+        t2.remove(page);
+    }
+}
+
+int arc_policy::eviction_candidates(int *frames, int max) const {
+    const page_list &first = t1.size > p ? t1 : t2;
+    const page_list &second = t1.size > p ? t2 : t1;
+    int count = list_candidates(first, frame_of, frames, 0, max);
+    return list_candidates(second, frame_of, frames, count, max);
+}
+
+// lirs
+
+lirs_policy::lirs_policy(int npages, int nframes)
+    : lir_limit(max(1, nframes - max(1, nframes / 100))), nlir(0),
+      state(npages, NONRESIDENT), frame_of(npages, -1) {
+    s.init(npages);
+    q.init(npages);
+}
+
+// The bottom of the stack must always be a LIR page
+void lirs_policy::prune() {
+    while (s.size > 0 && state[s.back()] != LIR) {
+        s.pop_back();
+    }
+}
+
+void lirs_policy::demote_bottom_lir() {
+    int bottom = s.pop_back();
+    state[bottom] = HIR;
+    q.push_front(bottom);
+    nlir--;
+    prune();
+}
+
+void lirs_policy::page_mapped(int page, int frame) {
+    frame_of[page] = frame;
+    bool in_stack = s.contains(page);
+    if (in_stack) {
+        s.remove(page);
+    }
+    s.push_front(page);
+
+    if (nlir < lir_limit) {
+        state[page] = LIR;
+        nlir++;
+    } else if (in_stack) {
+        // Reuse distance is shorter than the bottom LIR page's recency
+        state[page] = LIR;
+        nlir++;
+        demote_bottom_lir();
+    } else {
+        state[page] = HIR;
+        q.push_front(page);
+    }
+}
+
+void lirs_policy::page_referenced(int page, int frame) {
+    if (state[page] == LIR) {
+        bool bottom = s.back() == page;
+        s.remove(page);
+        s.push_front(page);
+        if (bottom) {
+            prune();
+        }
+    } else if (s.contains(page)) {
+        s.remove(page);
+        s.push_front(page);
+        q.remove(page);
+        state[page] = LIR;
+        nlir++;
+        if (nlir > lir_limit) {
+            demote_bottom_lir();
+        }
+    } else {
+        s.push_front(page);
+        q.remove(page);
+        q.push_front(page);
+    }
+}
+
+int lirs_policy::select_victim(int page) {
+    if (q.size == 0) {
+        demote_bottom_lir();
+    }
+    int victim = q.pop_back();
+    state[victim] = NONRESIDENT;
+    return frame_of[victim];
+}
+
+void lirs_policy::victim_busy(int page, int frame) {
+    // Still a resident HIR page, wherever it is in the stack
+    state[page] = HIR;
+    q.push_front(page);
+}
+
+void lirs_policy::page_removed(int page, int frame) {
+    if (state[page] == LIR) {
+        nlir--;
+    } else {
+        q.remove(page);
+    }
+    state[page] = NONRESIDENT;
+    if (s.contains(page)) {
+        s.remove(page);
+        prune();
+    }
+}
+
+int lirs_policy::eviction_candidates(int *frames, int max) const {
+    return list_candidates(q, frame_of, frames, 0, max);
+}
+
+// clockpro
+
+clock_pro_policy::clock_pro_policy(int npages, int nframes)
+    : nframes(nframes), cold_target(1), nhot(0), ncold(0), nnonresident(0),
+      hand_hot(-1), hand_cold(-1), hand_test(-1),
+      prev(npages, -1), next(npages, -1), member(npages, 0), hot(npages, 0),
+      resident(npages, 0), in_test(npages, 0), referenced(npages, 0), frame_of(npages, -1) {
+}
+
+// New pages go at the head of the clock, just behind hand_hot
+void clock_pro_policy::insert(int page) {
+    member[page] = 1;
+    if (hand_hot < 0) {
+        prev[page] = page;
+        next[page] = page;
+        hand_hot = hand_cold = hand_test = page;
+        return;
+    }
+    int before = prev[hand_hot];
+    prev[page] = before;
+    next[page] = hand_hot;
+    next[before] = page;
+    prev[hand_hot] = page;
+}
+
+void clock_pro_policy::unlink(int page) {
+    int after = next[page] == page ? -1 : next[page];
+    if (hand_hot == page) {
+        hand_hot = after;
+    }
+    if (hand_cold == page) {
+        hand_cold = after;
+    }
+    if (hand_test == page) {
+        hand_test = after;
+    }
+    if (after >= 0) {
+        next[prev[page]] = next[page];
+        prev[next[page]] = prev[page];
+    }
+    member[page] = 0;
+}
+
+// Demote one unreferenced hot page, ending the test periods passed on the way
+void clock_pro_policy::run_hand_hot() {
+    while (nhot > 0) {
+        int page = hand_hot;
+        hand_hot = next[page];
+        if (hot[page]) {
+            if (referenced[page]) {
+                referenced[page] = 0;
+            } else {
+                hot[page] = 0;
+                in_test[page] = 0;
+                nhot--;
+                ncold++;
+                return;
+            }
+        } else if (in_test[page]) {
+            in_test[page] = 0;
+            cold_target = max(1, cold_target - 1);
+            if (!resident[page]) {
+                unlink(page);
+                nnonresident--;
+            }
+        }
+    }
+}
+
+// Forget the oldest non-resident page still in its test period
+void clock_pro_policy::run_hand_test() {
+    while (nnonresident > 0) {
+        int page = hand_test;
+        hand_test = next[page];
+        if (!hot[page] && in_test[page]) {
+            in_test[page] = 0;
+            cold_target = max(1, cold_target - 1);
+            if (!resident[page]) {
+                unlink(page);
+                nnonresident--;
+                return;
+            }
+        }
+    }
+}
+
+void clock_pro_policy::page_mapped(int page, int frame) {
+    frame_of[page] = frame;
+    resident[page] = 1;
+    referenced[page] = 0;
+    if (member[page]) {
+        // Refault during the test period: the page is hot, and cold pages need more room
+        cold_target = min(max(1, nframes - 1), cold_target + 1);
+        unlink(page);
+        nnonresident--;
+        hot[page] = 1;
+        in_test[page] = 0;
+        insert(page);
+        nhot++;
+        while (nhot > nframes - cold_target) {
+            run_hand_hot();
+        }
+    } else {
+        hot[page] = 0;
+        in_test[page] = 1;
+        insert(page);
+        ncold++;
+    }
+}
+
+void clock_pro_policy::page_referenced(int page, int frame) {
+    referenced[page] = 1;
+}
+
+int clock_pro_policy::select_victim(int page) {
+    for (;;) {
+        if (ncold == 0) {
+            run_hand_hot();
+        }
+        while (!resident[hand_cold] || hot[hand_cold]) {
+            hand_cold = next[hand_cold];
+        }
+        int candidate = hand_cold;
+
+        if (referenced[candidate]) {
+            referenced[candidate] = 0;
+            unlink(candidate);
+            if (in_test[candidate]) {
+                // Reused within its test period
+                hot[candidate] = 1;
+                in_test[candidate] = 0;
+                ncold--;
+                nhot++;
+                insert(candidate);
+                while (nhot > nframes - cold_target) {
+                    run_hand_hot();
+                }
+            } else {
+                in_test[candidate] = 1;
+                insert(candidate);
+            }
+            continue;
+        }
+
+        resident[candidate] = 0;
+        ncold--;
+        hand_cold = next[candidate];
+        if (in_test[candidate]) {
+            // Remember it, so a refault soon can be recognised
+            nnonresident++;
+            while (nnonresident > nframes) {
+                run_hand_test();
+            }
+        } else {
+            unlink(candidate);
+        }
+        return frame_of[candidate];
+    }
+}
+
+void clock_pro_policy::victim_busy(int page, int frame) {
+    resident[page] = 1;
+    ncold++;
+    if (member[page]) {
+        // Kept in its test period, it is not a refault
+        nnonresident--;
+    } else {
+        hot[page] = 0;
+        in_test[page] = 0;
+        insert(page);
+    }
+}
+
+void clock_pro_policy::page_removed(int page, int frame) {
+    if (hot[page]) {
+        nhot--;
+    } else {
+        ncold--;
+    }
+    resident[page] = 0;
+    in_test[page] = 0;
+    unlink(page);
+}
+
+int clock_pro_policy::eviction_candidates(int *frames, int max) const {
+    int count = 0;
+    int page = hand_cold;
+    for (int seen = 0; page >= 0 && seen < ncold + nhot + nnonresident && count < max; seen++) {
+        if (resident[page] && !hot[page]) {
+            frames[count++] = frame_of[page];
+        }
+        page = next[page];
+    }
+    return count;
+}
@@ -0,0 +1,332 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stdint.h>
+#include <vector>
+
+/*
+An eviction policy only decides which resident page gets replaced when
+physical memory is full. Everything else about a fault (dirty tracking,
+disk I/O and updating the page table) is done once by the fault handler
+in main.cpp, which reports every event to the policy.
+
+A policy can only see the references that fault: the first touch of a
+page (page_mapped) and the first write to a page that was mapped read-only
+(page_referenced). All other accesses hit in memory and are invisible.
+*/
+
+struct eviction_policy
+{
+    virtual ~eviction_policy() {}
+
+    /* "page" has been loaded into "frame". */
+    virtual void page_mapped(int page, int frame) = 0;
+
+    /* The resident page "page" in "frame" was referenced again. */
+    virtual void page_referenced(int page, int frame) {}
+
+    /* Memory is full and "page" is about to be loaded: return the frame
+       to replace. The page in that frame is no longer tracked afterwards.
+       "page" is -1 if the frame goes to another address space. */
+    virtual int select_victim(int page) = 0;
+
+    /* The page in "frame" that select_victim chose is in use and can't be
+       evicted now: it stays resident. Undo what that select_victim did to
+       it, without crediting it with a refault of an evicted page. Other
+       victims may be chosen and given back before it. Policies that
+       remember no evicted pages simply treat it as loaded again. */
+    virtual void victim_busy(int page, int frame) { page_mapped(page, frame); }
+
+    /* A resident page left memory without being chosen by select_victim. */
+    virtual void page_removed(int page, int frame) = 0;
+
+    /* Fill "frames" with up to "max" frames, most likely next victim first,
+       without changing any state. Returns how many were filled, or 0 if
+       the policy has no idea (for example random eviction). */
+    virtual int eviction_candidates(int *frames, int max) const { return 0; }
+};
+
+/*
+Create the policy called "name" for a virtual memory of "npages" pages
+and a physical memory of "nframes" frames, of which the address space may
+hold at most "capacity" (all of them if 0). "seed" starts the random numbers
+of policies that use them, so that a run can be repeated exactly.
+Returns null if there is no such policy.
+*/
+
+eviction_policy *eviction_policy_create(const char *name, int npages, int nframes, int capacity = 0,
+                                        unsigned seed = 0);
+
+/* Names accepted by eviction_policy_create, terminated by a null pointer. */
+
+extern const char *const eviction_policy_names[];
+
+/*
+Every policy, in the order of eviction_policy_names, as X(name, type, args)
+where "args" are the constructor arguments, over the parameters of
+eviction_policy_create. Anything else that needs one entry per policy, like
+the fault handlers of main.cpp, expands this list rather than repeat it.
+*/
+
+#define EVICTION_POLICIES(X) \
+    X("rand", rand_policy, (nframes, seed)) \
+    X("fifo", fifo_policy, (nframes)) \
+    X("custom", clock_policy, (nframes)) \
+    X("lru", lru_policy, (npages)) \
+    X("2q", two_queue_policy, (npages, capacity)) \
+    X("arc", arc_policy, (npages, capacity)) \
+    X("lirs", lirs_policy, (npages, capacity)) \
+    X("clockpro", clock_pro_policy, (npages, capacity))
+
+/*
+Doubly linked list of page numbers, threaded through arrays indexed by page
+so that insertion, removal and membership tests are O(1) without allocating.
+The front is the most recently inserted page.
+*/
+
+struct page_list
+{
+    std::vector<int> prev;
+    std::vector<int> next;
+    std::vector<char> member;
+    int head;
+    int tail;
+    int size;
+
+    void init(int npages);
+    bool contains(int page) const { return member[page] != 0; }
+    int back() const { return tail; }
+    int before(int page) const { return prev[page]; }
+
+    void push_front(int page)
+    {
+        prev[page] = -1;
+        next[page] = head;
+        if (head >= 0)
+        {
+            prev[head] = page;
+        }
+        else
+        {
+            tail = page;
+        }
+        head = page;
+        member[page] = 1;
+        size++;
+    }
+
+    void remove(int page)
+    {
+        if (prev[page] >= 0)
+        {
+            next[prev[page]] = next[page];
+        }
+        else
+        {
+            head = next[page];
+        }
+        if (next[page] >= 0)
+        {
+            prev[next[page]] = prev[page];
+        }
+        else
+        {
+            tail = prev[page];
+        }
+        member[page] = 0;
+        size--;
+    }
+
+    int pop_back()
+    {
+        int page = tail;
+        remove(page);
+        return page;
+    }
+};
+
+/* Evict a resident page chosen uniformly at random. It has its own generator
+   (xorshift64*), so the programs' calls to rand() don't change its choices.
+   The resident frames are kept dense, so a victim is one draw however few
+   of the frames the address space holds. */
+
+struct rand_policy final : eviction_policy
+{
+    uint64_t state;
+    std::vector<int> frames;   // the resident frames, in no order
+    int nresident;
+    std::vector<int> index_of; // position of each frame in "frames", -1 if not resident
+
+    rand_policy(int nframes, unsigned seed);
+    void page_mapped(int page, int frame);
+    int select_victim(int page);
+    void page_removed(int page, int frame);
+};
+
+/* Evict the page that was loaded first. */
+
+struct fifo_policy final : eviction_policy
+{
+    page_list order; // of frames, by load time
+
+    fifo_policy(int nframes);
+    void page_mapped(int page, int frame);
+    int select_victim(int page);
+    void page_removed(int page, int frame);
+    int eviction_candidates(int *frames, int max) const;
+};
+
+/* Second chance clock over the frames (the "custom" algorithm). */
+
+struct clock_policy final : eviction_policy
+{
+    int nframes;
+    int index;
+    std::vector<char> used;     // per frame
+    std::vector<char> resident; // per frame
+
+    clock_policy(int nframes);
+    void page_mapped(int page, int frame);
+    void page_referenced(int page, int frame);
+    int select_victim(int page);
+    void page_removed(int page, int frame);
+    int eviction_candidates(int *frames, int max) const;
+};
+
+/* Least recently used, ordered by the references that fault. */
+
+struct lru_policy final : eviction_policy
+{
+    page_list recency;
+    std::vector<int> frame_of;
+
+    lru_policy(int npages);
+    void page_mapped(int page, int frame);
+    void page_referenced(int page, int frame);
+    int select_victim(int page);
+    void page_removed(int page, int frame);
+    int eviction_candidates(int *frames, int max) const;
+};
+
+/*
+2Q (Johnson and Shasha). New pages go to a FIFO "a1in"; only pages that are
+faulted on again while remembered in the ghost queue "a1out" are promoted to
+the LRU queue "am", so a single pass over memory cannot flush "am".
+*/
+
+struct two_queue_policy final : eviction_policy
+{
+    int kin;
+    int kout;
+    page_list a1in;
+    page_list a1out;
+    page_list am;
+    std::vector<int> frame_of;
+
+    two_queue_policy(int npages, int nframes);
+    void page_mapped(int page, int frame);
+    void page_referenced(int page, int frame);
+    int select_victim(int page);
+    void victim_busy(int page, int frame);
+    void page_removed(int page, int frame);
+    int eviction_candidates(int *frames, int max) const;
+};
+
+/*
+ARC (Megiddo and Modha). Resident pages seen once (t1) and more than once (t2)
+are balanced by a target size "p" for t1, adapted on hits in the ghost lists
+b1 and b2 of recently evicted pages.
+*/
+
+struct arc_policy final : eviction_policy
+{
+    int c;
+    int p;
+    std::vector<int> adapted; // how much select_victim moved "p" when it chose each page
+    page_list t1;
+    page_list t2;
+    page_list b1;
+    page_list b2;
+    std::vector<int> frame_of;
+
+    arc_policy(int npages, int nframes);
+    void page_mapped(int page, int frame);
+    void page_referenced(int page, int frame);
+    int select_victim(int page);
+    void victim_busy(int page, int frame);
+    void page_removed(int page, int frame);
+    int eviction_candidates(int *frames, int max) const;
+};
+
+/*
+LIRS (Jiang and Zhang). Pages with a short reuse distance (LIR) keep most of
+the frames; the remaining few frames hold HIR pages in the queue "q", which is
+where victims come from. The stack "s" remembers recency, including evicted
+HIR pages, so that a quick refault can be promoted to LIR.
+*/
+
+struct lirs_policy final : eviction_policy
+{
+    enum { LIR, HIR, NONRESIDENT };
+
+    int lir_limit;
+    int nlir;
+    page_list s;
+    page_list q;
+    std::vector<char> state;
+    std::vector<int> frame_of;
+
+    lirs_policy(int npages, int nframes);
+    void page_mapped(int page, int frame);
+    void page_referenced(int page, int frame);
+    int select_victim(int page);
+    void victim_busy(int page, int frame);
+    void page_removed(int page, int frame);
+    int eviction_candidates(int *frames, int max) const;
+
+    void prune();
+    void demote_bottom_lir();
+};
+
+/*
+CLOCK-Pro (Jiang, Chen and Zhang). A single clock holds hot and cold resident
+pages plus evicted cold pages still in their test period. hand_cold evicts
+unreferenced cold pages, hand_hot demotes unreferenced hot pages, and
+hand_test ends test periods. A refault during the test period makes the page
+hot and grows the share of frames kept for cold pages.
+*/
+
+struct clock_pro_policy final : eviction_policy
+{
+    int nframes;
+    int cold_target;
+    int nhot;
+    int ncold;
+    int nnonresident;
+    int hand_hot;
+    int hand_cold;
+    int hand_test;
+    std::vector<int> prev;
+    std::vector<int> next;
+    std::vector<char> member;
+    std::vector<char> hot;
+    std::vector<char> resident;
+    std::vector<char> in_test;
+    std::vector<char> referenced;
+    std::vector<int> frame_of;
+
+    clock_pro_policy(int npages, int nframes);
+    void page_mapped(int page, int frame);
+    void page_referenced(int page, int frame);
+    int select_victim(int page);
+    void victim_busy(int page, int frame);
+    void page_removed(int page, int frame);
+    int eviction_candidates(int *frames, int max) const;
+
+    void insert(int page);
+    void unlink(int page);
+    void run_hand_hot();
+    void run_hand_test();
+};
+
+#endif
@@ -6,10 +6,15 @@ Make all of your changes to main.cpp instead.
 #include "program.h"
 
 #include <iostream>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
 
 using std::cout;
 using std::endl;
 
+unsigned program_seed = 0;
+
 static int compare_bytes(const void *pa, const void *pb)
 {
     int a = *(char *)pa;
@@ -36,7 +41,7 @@ void focus_program(char *data, int length)
     char *data_verify = new char[length];
     int total_verify = 0;
 
-    srand(38290);
+    srand(38290 + program_seed);
 
     for (i = 0; i < length; i++)
     {
@@ -83,7 +88,7 @@ void sort_program(char *data, int length)
     char *data_verify = new char[length];
     int total_verify = 0;
 
-    srand(4856);
+    srand(4856 + program_seed);
 
     for (i = 0; i < length; i++)
     {
@@ -180,3 +185,213 @@ void custom_program(char *cdata, int length)
         exit(1);
     }
 }
+
+// Reads one byte of every page, ten times over, so that nearly every access
+// faults when memory is small. Used to measure the cost of a fault.
+void touch_program(char *cdata, int length)
+{
+    unsigned i, j;
+    unsigned char *data = (unsigned char *)cdata;
+    unsigned total = 0;
+
+    for (j = 0; j < 10; j++)
+    {
+        for (i = 0; i < (unsigned)length; i += 4096)
+        {
+            total += data[i];
+        }
+    }
+
+    cout << "Touch Done: Result = " << total << endl;
+}
+
+// Multi-threaded versions of scan, sort and focus, to measure how fault
+// handling scales with the number of faulting threads. The data is split
+// into one contiguous slice per thread. Slices may share a page at their
+// boundaries, so the threads also fault on the same pages now and then.
+
+// Run "body(t, start, end)" in a thread of its own for each slice [start, end)
+template <class Body>
+static void run_slices(int length, int nthreads, Body body)
+{
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < nthreads; t++)
+    {
+        int start = (long)length * t / nthreads;
+        int end = (long)length * (t + 1) / nthreads;
+        threads.emplace_back(body, t, start, end);
+    }
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void scan_mt_program(char *cdata, int length, int nthreads)
+{
+    unsigned char *data = (unsigned char *)cdata;
+    std::vector<unsigned> totals(nthreads);
+    std::vector<unsigned> totals_verify(nthreads);
+
+    run_slices(length, nthreads, [&](int t, int start, int end)
+    {
+        int i, j;
+        unsigned total = 0;
+        unsigned total_verify = 0;
+
+        for (i = start; i < end; i++)
+        {
+            data[i] = i % 256;
+        }
+
+        for (j = 0; j < 10; j++)
+        {
+            for (i = start; i < end; i++)
+            {
+                total += data[i];
+                total_verify += i % 256;
+            }
+        }
+
+        totals[t] = total;
+        totals_verify[t] = total_verify;
+    });
+
+    unsigned total = 0;
+    unsigned total_verify = 0;
+    for (int t = 0; t < nthreads; t++)
+    {
+        total += totals[t];
+        total_verify += totals_verify[t];
+    }
+
+    if (total == total_verify)
+    {
+        cout << "Scan-MT Successful: Result = " << total << endl;
+    }
+    else
+    {
+        cout << "Scan-MT Failed: Result = " << total << ", Expected = " << total_verify << endl;
+        exit(1);
+    }
+}
+
+void sort_mt_program(char *data, int length, int nthreads)
+{
+    char *data_verify = new char[length];
+    std::vector<int> totals(nthreads);
+    std::vector<int> totals_verify(nthreads);
+
+    run_slices(length, nthreads, [&](int t, int start, int end)
+    {
+        unsigned seed = 4856 + program_seed + t;
+        int i;
+        int total = 0;
+        int total_verify = 0;
+
+        for (i = start; i < end; i++)
+        {
+            char value = rand_r(&seed);
+            data[i] = value;
+            data_verify[i] = value;
+        }
+
+        qsort(data + start, end - start, 1, compare_bytes);
+        qsort(data_verify + start, end - start, 1, compare_bytes);
+
+        for (i = start; i < end; i++)
+        {
+            total += data[i];
+            total_verify += data_verify[i];
+        }
+
+        totals[t] = total;
+        totals_verify[t] = total_verify;
+    });
+
+    delete[] data_verify;
+
+    int total = 0;
+    int total_verify = 0;
+    for (int t = 0; t < nthreads; t++)
+    {
+        total += totals[t];
+        total_verify += totals_verify[t];
+    }
+
+    if (total == total_verify)
+    {
+        cout << "Sort-MT Successful: Result = " << total << endl;
+    }
+    else
+    {
+        cout << "Sort-MT Failed: Result = " << total << ", Expected = " << total_verify << endl;
+        exit(1);
+    }
+}
+
+void focus_mt_program(char *data, int length, int nthreads)
+{
+    char *data_verify = new char[length];
+    std::vector<int> totals(nthreads);
+    std::vector<int> totals_verify(nthreads);
+
+    run_slices(length, nthreads, [&](int t, int start, int end)
+    {
+        unsigned seed = 38290 + program_seed + t;
+        int slice = end - start;
+        int i, j;
+        int total = 0;
+        int total_verify = 0;
+
+        for (i = start; i < end; i++)
+        {
+            data[i] = 0;
+            data_verify[i] = 0;
+        }
+
+        for (j = 0; j < 100 && slice > 0; j++)
+        {
+            int focus = rand_r(&seed) % slice;
+            int size = 25;
+            for (i = 0; i < 100; i++)
+            {
+                int index = start + (focus + rand_r(&seed) % size) % slice;
+                char value = rand_r(&seed);
+                data[index] = value;
+                data_verify[index] = value;
+            }
+        }
+
+        for (i = start; i < end; i++)
+        {
+            total += data[i];
+            total_verify += data_verify[i];
+        }
+
+        totals[t] = total;
+        totals_verify[t] = total_verify;
+    });
+
+    delete[] data_verify;
+
+    int total = 0;
+    int total_verify = 0;
+    for (int t = 0; t < nthreads; t++)
+    {
+        total += totals[t];
+        total_verify += totals_verify[t];
+    }
+
+    if (total == total_verify)
+    {
+        cout << "Focus-MT Successful: Result = " << total << endl;
+    }
+    else
+    {
+        cout << "Focus-MT Failed: Result = " << total << ", Expected = " << total_verify << endl;
+        exit(1);
+    }
+}
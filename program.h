@@ -6,9 +6,18 @@ Make all of your changes to main.cpp instead.
 #ifndef PROGRAM_H
 #define PROGRAM_H
 
+// Added to the fixed seeds of the programs that use random numbers, so that
+// runs can differ in their data; 0 gives the original sequences
+extern unsigned program_seed;
+
 void scan_program(char *data, int length);
 void sort_program(char *data, int length);
 void focus_program(char *data, int length);
 void custom_program(char *data, int length);
+void touch_program(char *data, int length);
+
+void scan_mt_program(char *data, int length, int nthreads);
+void sort_mt_program(char *data, int length, int nthreads);
+void focus_mt_program(char *data, int length, int nthreads);
 
 #endif
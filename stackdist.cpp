@@ -0,0 +1,207 @@
+#include "stackdist.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+
+// Marks the time of the last reference of every followed page. Times run
+// from 0 to capacity - 1, then the live marks are renumbered in order, so the
+// tree stays as small as a few times the number of pages.
+struct recency_tree
+{
+    std::vector<int> tree;      // Fenwick tree of the marks, 1-based
+    std::vector<int> page_at;   // page marked at each time, -1 if none
+    std::vector<int> time_of;   // per page, -1 if never referenced
+    int now;
+    int live;
+
+    recency_tree(int npages)
+        : tree(2 * npages + 65, 0), page_at(2 * npages + 64, -1), time_of(npages, -1), now(0), live(0) {}
+
+    void add(int time, int delta)
+    {
+        for (int i = time + 1; i < (int)tree.size(); i += i & -i)
+        {
+            tree[i] += delta;
+        }
+    }
+
+    // Marks at times 0 to "time"
+    int prefix(int time) const
+    {
+        int sum = 0;
+        for (int i = time + 1; i > 0; i -= i & -i)
+        {
+            sum += tree[i];
+        }
+        return sum;
+    }
+
+    void compact()
+    {
+        int next = 0;
+        for (int time = 0; time < now; time++)
+        {
+            int page = page_at[time];
+            page_at[time] = -1;
+            if (page >= 0)
+            {
+                page_at[next] = page;
+                time_of[page] = next++;
+            }
+        }
+        // Rebuild in O(capacity): every node adds itself to its parent
+        for (int i = 1; i < (int)tree.size(); i++)
+        {
+            tree[i] = i <= next ? 1 : 0;
+        }
+        for (int i = 1; i < (int)tree.size(); i++)
+        {
+            int parent = i + (i & -i);
+            if (parent < (int)tree.size())
+            {
+                tree[parent] += tree[i];
+            }
+        }
+        now = next;
+    }
+
+    // Stack distance "page" would have now, 0 if never referenced
+    int depth(int page) const
+    {
+        int last = time_of[page];
+        return last >= 0 ? live - prefix(last) + 1 : 0;
+    }
+
+    // Reference "page", return its stack distance or 0 on its first reference
+    int reference(int page)
+    {
+        int distance = depth(page);
+        int last = time_of[page];
+        if (last >= 0)
+        {
+            add(last, -1);
+            page_at[last] = -1;
+            live--;
+        }
+        if (now == (int)page_at.size())
+        {
+            compact();
+        }
+        add(now, 1);
+        page_at[now] = page;
+        time_of[page] = now++;
+        live++;
+        return distance;
+    }
+};
+
+// Spread the bits of the page number (the splitmix64 finalizer)
+static uint64_t hash_page(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+bool lru_miss_curve(struct trace *t, double sample_rate, miss_curve &curve)
+{
+    int npages = trace_npages(t);
+    bool sampled = sample_rate < 1;
+    uint64_t threshold = sample_rate * (1 << 24);
+    double weight = sampled ? 1 / sample_rate : 1;
+
+    // Counts by distance, index npages + 1 for anything farther
+    std::vector<double> misses(npages + 2, 0);
+    std::vector<double> read_misses(npages + 2, 0); // of pages written before
+    std::vector<double> writeback_changes(npages + 2, 0);
+    double cold_misses = 0;
+    std::vector<int> dirty_from(npages, INT_MAX); // smallest memory the page is dirty in
+    std::vector<char> filled(npages, 0);          // same-filled since its last write
+
+    // Scale a distance among the followed pages to all pages
+    auto scale = [&](int distance) {
+        long scaled = sampled ? std::max(1L, lround(distance * weight)) : distance;
+        return (int)std::min(scaled, npages + 1L);
+    };
+    // The page was evicted from the memories smaller than "distance" frames,
+    // dirty from those of dirty_from frames up, and written unless same-filled
+    auto write_back = [&](int page, int distance) {
+        if (dirty_from[page] < distance && !filled[page])
+        {
+            writeback_changes[dirty_from[page]] += weight;
+            writeback_changes[distance] -= weight;
+        }
+    };
+
+    recency_tree recency(npages);
+    struct trace_cursor c = trace_begin(t);
+    int page, flags;
+    while (trace_next(&c, &page, &flags))
+    {
+        if (page < 0 || page >= npages)
+        {
+            return false;
+        }
+        if (sampled && (hash_page(page) & ((1 << 24) - 1)) >= threshold)
+        {
+            continue;
+        }
+
+        int distance = recency.reference(page);
+        if (distance == 0)
+        {
+            cold_misses += weight;
+        }
+        else
+        {
+            distance = scale(distance);
+            misses[distance] += weight;
+            if (dirty_from[page] != INT_MAX && !filled[page])
+            {
+                read_misses[distance] += weight;
+            }
+            write_back(page, distance);
+        }
+        if (flags & TRACE_WRITE)
+        {
+            dirty_from[page] = 1;
+            filled[page] = (flags & TRACE_FILLED) != 0;
+        }
+        else if (dirty_from[page] != INT_MAX)
+        {
+            dirty_from[page] = std::max(dirty_from[page], distance);
+        }
+    }
+
+    // Dirty pages pushed out by the last references and never used again
+    for (page = 0; page < npages; page++)
+    {
+        if (dirty_from[page] != INT_MAX)
+        {
+            write_back(page, scale(recency.depth(page)));
+        }
+    }
+
+    curve.page_faults.assign(npages + 1, 0);
+    curve.disk_writes.assign(npages + 1, 0);
+    curve.disk_reads.assign(npages + 1, 0);
+    double farther = cold_misses;
+    double farther_reads = 0;
+    double writes = 0;
+    for (int d = npages + 1; d > 0; d--)
+    {
+        farther += misses[d];
+        farther_reads += read_misses[d];
+        curve.page_faults[d - 1] = farther;
+        curve.disk_reads[d - 1] = farther_reads;
+    }
+    for (int n = 0; n <= npages; n++)
+    {
+        writes += writeback_changes[n];
+        curve.disk_writes[n] = writes;
+    }
+    return true;
+}
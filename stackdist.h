@@ -0,0 +1,50 @@
+#ifndef STACKDIST_H
+#define STACKDIST_H
+
+#include <vector>
+
+struct trace;
+
+/*
+Miss curve of LRU for every number of frames from one pass over a trace
+(Mattson et al.). LRU is a stack algorithm: a memory of n frames always holds
+the n most recently used pages, so a reference misses exactly when more than
+n-1 other pages were used since the last reference to its page (its stack
+distance). The distances are counted with a Fenwick tree over the time of
+each page's last reference, O(log npages) per reference.
+
+A dirty page is written back when it is evicted, which with n frames happens
+at a reference whose distance is above n, to a page written since its last
+reference of distance above n. Every page remembers the largest distance
+since its last write, so the writebacks of all sizes are exact too. A miss
+reads the disk if its page was written at any earlier reference: in every
+memory it misses in, it was evicted since, and it was written back then or
+before. Misses of pages never written read nothing, like in the swap. Nor
+do the writebacks and misses of a page whose last write left it same-filled
+(TRACE_FILLED), which the swap keeps without the disk.
+
+This is LRU over every reference in the trace, not the "lru" policy, which
+only sees the references that fault.
+
+With "sample_rate" below 1 only the pages whose hash falls below that
+fraction are followed (SHARDS, Waldspurger et al.), and their distances and
+counts are scaled up by 1 / sample_rate. That is an approximation, but it
+needs time and memory in proportion to the sampled references only.
+*/
+
+struct miss_curve
+{
+    /* Indexed by the number of frames, 0 to npages. */
+    std::vector<double> page_faults;
+    std::vector<double> disk_writes;
+    std::vector<double> disk_reads;
+};
+
+/*
+Compute the miss curve of "t". Returns false if the trace refers to pages
+beyond its number of pages.
+*/
+
+bool lru_miss_curve(struct trace *t, double sample_rate, miss_curve &curve);
+
+#endif
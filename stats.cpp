@@ -0,0 +1,123 @@
+#include "stats.h"
+
+const char *const fault_phase_names[NPHASES] = { "entry", "policy", "diskwrite", "diskread",
+                                                 "remap", "major", "minor" };
+
+// Both clocks when the program started, to convert ticks to nanoseconds
+static uint64_t start_ticks = stats_now();
+static struct timespec start_time = []() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts;
+}();
+
+double stats_ns_per_tick()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ticks = stats_now() - start_ticks;
+    double ns = (now.tv_sec - start_time.tv_sec) * 1e9 + (now.tv_nsec - start_time.tv_nsec);
+    return ticks > 0 ? ns / ticks : 1;
+#else
+    return 1;
+#endif
+}
+
+// Bucket of a value: the value itself below 128, otherwise its power of two
+// and the 6 bits that follow its leading one
+static int bucket_of(uint64_t ticks)
+{
+    if (ticks < 128)
+    {
+        return ticks;
+    }
+    int exponent = 63 - __builtin_clzll(ticks);
+    int bucket = 128 + (exponent - 7) * 64 + ((ticks >> (exponent - 6)) & 63);
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+// Middle of the values of a bucket
+static double bucket_value(int bucket)
+{
+    if (bucket < 128)
+    {
+        return bucket;
+    }
+    int exponent = 7 + (bucket - 128) / 64;
+    double width = (double)(1ULL << (exponent - 6));
+    return (64 + (bucket - 128) % 64) * width + width / 2;
+}
+
+latency_histogram::latency_histogram()
+{
+    for (std::atomic<uint64_t> &count : counts)
+    {
+        count = 0;
+    }
+    total = 0;
+    max = 0;
+}
+
+void latency_histogram::record(uint64_t ticks)
+{
+    counts[bucket_of(ticks)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(ticks, std::memory_order_relaxed);
+    uint64_t seen = max.load(std::memory_order_relaxed);
+    while (ticks > seen && !max.compare_exchange_weak(seen, ticks, std::memory_order_relaxed))
+    {
+    }
+}
+
+latency_summary latency_summarize(const latency_histogram &h)
+{
+    double scale = stats_ns_per_tick();
+    latency_summary s = { 0, 0, 0, 0, 0, 0, 0 };
+    for (const std::atomic<uint64_t> &count : h.counts)
+    {
+        s.count += count.load(std::memory_order_relaxed);
+    }
+    if (s.count == 0)
+    {
+        return s;
+    }
+    s.mean = (double)h.total.load(std::memory_order_relaxed) / s.count * scale;
+    s.max = h.max.load(std::memory_order_relaxed) * scale;
+
+    const double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+    double *values[4] = { &s.p50, &s.p90, &s.p99, &s.p999 };
+    uint64_t seen = 0;
+    int q = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS && q < 4; bucket++)
+    {
+        seen += h.counts[bucket].load(std::memory_order_relaxed);
+        while (q < 4 && seen >= quantiles[q] * s.count)
+        {
+            // Never above the largest value actually seen
+            *values[q] = bucket_value(bucket) * scale;
+            if (*values[q] > s.max)
+            {
+                *values[q] = s.max;
+            }
+            q++;
+        }
+    }
+    return s;
+}
+
+void fault_stats::record(const phase_timer &timer, int kind)
+{
+    if (kind == PHASE_MAJOR)
+    {
+        phases[PHASE_ENTRY].record(timer.ticks[PHASE_ENTRY]);
+        for (int phase = PHASE_POLICY; phase <= PHASE_REMAP; phase++)
+        {
+            // Only the faults that went through the phase, most don't write
+            if (timer.ticks[phase] > 0)
+            {
+                phases[phase].record(timer.ticks[phase]);
+            }
+        }
+    }
+    phases[kind].record(timer.last - timer.start);
+}
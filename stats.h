@@ -0,0 +1,133 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+Always-on timing of the fault path. Timestamps are raw ticks of the cheapest
+clock there is, the time stamp counter on x86 (a few nanoseconds to read) and
+CLOCK_MONOTONIC elsewhere. They are only turned into nanoseconds when a
+histogram is summarized, by comparing both clocks since the program started.
+*/
+
+static inline uint64_t stats_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Nanoseconds per tick of stats_now. */
+
+double stats_ns_per_tick();
+
+/*
+Where the time of a fault goes. A major fault (the page is not in memory) is
+split into:
+  entry:      from the backend getting the fault (signal handler or
+              userfaultfd event) to the handler holding the page lock
+  policy:     choosing a victim and telling the policy about the new page
+  diskwrite:  writing back a dirty victim (queueing it with async I/O)
+  diskread:   reading the page, and the pages faulted around or read ahead
+  remap:      updating the page table
+and its total service time is "major". A minor fault (a write to a page
+mapped read-only) is only timed as a whole, "minor". The count of the major
+and minor histograms is the number of faults of each kind.
+*/
+
+enum fault_phase
+{
+    PHASE_ENTRY,
+    PHASE_POLICY,
+    PHASE_DISK_WRITE,
+    PHASE_DISK_READ,
+    PHASE_REMAP,
+    PHASE_MAJOR,
+    PHASE_MINOR,
+    NPHASES
+};
+
+extern const char *const fault_phase_names[NPHASES];
+
+/*
+Histogram of durations in ticks, HDR style: exact below 128, then 64
+buckets per power of two, so any value is known within 1.6%. Recording is
+two relaxed atomic additions, several threads may record at once.
+*/
+
+#define HISTOGRAM_BUCKETS (128 + 64 * 42)
+
+struct latency_histogram
+{
+    std::atomic<uint64_t> counts[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> max;
+
+    latency_histogram();
+    void record(uint64_t ticks);
+};
+
+/* A histogram in nanoseconds, small enough to send through a pipe. */
+
+struct latency_summary
+{
+    uint64_t count;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+};
+
+latency_summary latency_summarize(const latency_histogram &h);
+
+/*
+Time of the fault being handled by one thread. begin() starts it, and each
+lap() charges the time since the previous lap (or begin) to a phase, so the
+phases always add up to the total.
+*/
+
+struct phase_timer
+{
+    uint64_t start;
+    uint64_t last;
+    uint64_t ticks[NPHASES];
+
+    void begin(uint64_t now)
+    {
+        start = last = now;
+        for (uint64_t &t : ticks)
+        {
+            t = 0;
+        }
+    }
+
+    void lap(int phase)
+    {
+        uint64_t now = stats_now();
+        ticks[phase] += now - last;
+        last = now;
+    }
+};
+
+/* The histograms of every phase of an address space. */
+
+struct fault_stats
+{
+    latency_histogram phases[NPHASES];
+
+    /* Record a fault timed by "timer", "kind" is PHASE_MAJOR or PHASE_MINOR. */
+    void record(const phase_timer &timer, int kind);
+};
+
+#endif
@@ -0,0 +1,886 @@
+#include "swap.h"
+#include "disk.h"
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Largest compressed page the pool takes
+#define POOL_MAX_COMPRESSED (BLOCK_SIZE * 3 / 4)
+
+// Blocks of a segment of the log, the unit the compactor frees
+#define SEGMENT_BLOCKS 32
+
+// Pages swap_readv and swap_writev take under the lock at a time
+#define SWAP_BATCH 64
+
+// A compressed page in the pool arena, followed by its "length" bytes and
+// padded to 8 bytes. A record of page -1 pads the arena up to its end.
+struct pool_record
+{
+    int32_t page;
+    int32_t length;
+};
+
+struct swap
+{
+    struct disk *disk;
+    int npages;
+    std::vector<char> stored;        // 1 if the page is in the pool or on the disk
+    std::vector<uint64_t> fill_of;   // the word the page is filled with otherwise
+
+    std::mutex lock;     // for everything below
+
+    // The log on the disk. Blocks are written in order within the open
+    // segment, each one to a new block, and the old block of the page goes
+    // stale. Segments that are full can be compacted.
+    int nsegments;
+    std::vector<int> slot_of;        // block of each page, -1 if none
+    std::vector<int> page_of;        // page in each block, -1 if the block is free or stale
+    std::vector<int> live;           // blocks of each segment still in use
+    std::vector<int> pins;           // reads and writes of each segment under way without the lock
+    std::vector<char> closed;        // segments that are full and not compacted yet
+    std::vector<int> free_segments;
+    int log_segment;                 // the open segment, -1 before the first write
+    int log_next;                    // its next block
+    std::thread *compactor;
+    char *moving;                    // a segment's worth of blocks each, aligned to a block, for
+    char *compacting;                // log_compact from log_alloc and from the compactor
+    std::condition_variable compact_wakeup;
+    bool stopping;
+
+    char *pool;          // the arena, null without a pool
+    long pool_size;
+    long head;           // oldest record
+    long tail;           // where the next record goes
+    long used;           // bytes from head to tail, including dead records
+    std::vector<long> offset_of; // record of each page in the arena, -1 if none
+    struct swap_stats stats;
+};
+
+/* Same-filled pages */
+
+// Check if a block is one 8 byte word over and over, and give that word
+static bool block_is_filled(const char *data, uint64_t *word)
+{
+    memcpy(word, data, sizeof(*word));
+#ifdef __SSE2__
+    __m128i pattern = _mm_set1_epi64x(*word);
+    for (int i = 0; i < BLOCK_SIZE; i += 64)
+    {
+        const __m128i *p = (const __m128i *)(data + i);
+        __m128i diff = _mm_or_si128(_mm_or_si128(_mm_xor_si128(_mm_loadu_si128(p), pattern),
+                                                 _mm_xor_si128(_mm_loadu_si128(p + 1), pattern)),
+                                    _mm_or_si128(_mm_xor_si128(_mm_loadu_si128(p + 2), pattern),
+                                                 _mm_xor_si128(_mm_loadu_si128(p + 3), pattern)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff)
+        {
+            return false;
+        }
+    }
+#else
+    for (int i = sizeof(*word); i < BLOCK_SIZE; i += sizeof(*word))
+    {
+        uint64_t w;
+        memcpy(&w, data + i, sizeof(w));
+        if (w != *word)
+        {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+static void fill_block(char *data, uint64_t word)
+{
+    if (word == (word & 0xff) * 0x0101010101010101ULL)
+    {
+        memset(data, word & 0xff, BLOCK_SIZE);
+        return;
+    }
+    for (int i = 0; i < BLOCK_SIZE; i += sizeof(word))
+    {
+        memcpy(data + i, &word, sizeof(word));
+    }
+}
+
+/* LZ77 codec, with LZ4-style blocks */
+
+#define MIN_MATCH 4
+#define HASH_BITS 12
+
+static inline uint32_t load32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Write a length of 15 or more as the extra bytes after a token
+static inline unsigned char *put_length(unsigned char *op, int length)
+{
+    for (length -= 15; length >= 255; length -= 255)
+    {
+        *op++ = 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+// Compress a block into "dst", returns the compressed length, or 0 if it
+// would be longer than "max"
+static int compress_block(const char *src, char *dst, int max)
+{
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst;
+    unsigned char *op = out;
+    uint16_t table[1 << HASH_BITS]; // last position + 1 of each hash, 0 for none
+    memset(table, 0, sizeof(table));
+
+    int anchor = 0;
+    int ip = 0;
+    while (ip + MIN_MATCH <= BLOCK_SIZE)
+    {
+        uint32_t sequence = load32(in + ip);
+        uint32_t h = hash32(sequence);
+        int ref = table[h] - 1;
+        table[h] = ip + 1;
+        if (ref < 0 || load32(in + ref) != sequence)
+        {
+            ip++;
+            continue;
+        }
+
+        int match = MIN_MATCH;
+        while (ip + match < BLOCK_SIZE && in[ref + match] == in[ip + match])
+        {
+            match++;
+        }
+        int literals = ip - anchor;
+        // Token, lengths, literals and offset, at most this long
+        if (op - out + 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1 > max)
+        {
+            return 0;
+        }
+        unsigned char *token = op++;
+        *token = (literals < 15 ? literals : 15) << 4;
+        if (literals >= 15)
+        {
+            op = put_length(op, literals);
+        }
+        memcpy(op, in + anchor, literals);
+        op += literals;
+        int offset = ip - ref;
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        int extra = match - MIN_MATCH;
+        *token |= extra < 15 ? extra : 15;
+        if (extra >= 15)
+        {
+            op = put_length(op, extra);
+        }
+        ip += match;
+        anchor = ip;
+    }
+
+    // The last literals, without a match
+    int literals = BLOCK_SIZE - anchor;
+    if (op - out + 1 + literals / 255 + 1 + literals > max)
+    {
+        return 0;
+    }
+    unsigned char *token = op++;
+    *token = (literals < 15 ? literals : 15) << 4;
+    if (literals >= 15)
+    {
+        op = put_length(op, literals);
+    }
+    memcpy(op, in + anchor, literals);
+    op += literals;
+    return op - out;
+}
+
+static inline const unsigned char *get_length(const unsigned char *ip, int *length)
+{
+    unsigned char byte;
+    do
+    {
+        byte = *ip++;
+        *length += byte;
+    } while (byte == 255);
+    return ip;
+}
+
+// Decompress "length" bytes of "src" into a whole block
+static void decompress_block(const char *src, int length, char *dst)
+{
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *end = ip + length;
+    unsigned char *op = (unsigned char *)dst;
+    for (;;)
+    {
+        unsigned char token = *ip++;
+        int literals = token >> 4;
+        if (literals == 15)
+        {
+            ip = get_length(ip, &literals);
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip >= end)
+        {
+            return;
+        }
+
+        int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        int match = token & 15;
+        if (match == 15)
+        {
+            ip = get_length(ip, &match);
+        }
+        match += MIN_MATCH;
+        // Byte by byte, the match may overlap what it produces
+        const unsigned char *from = op - offset;
+        for (int i = 0; i < match; i++)
+        {
+            op[i] = from[i];
+        }
+        op += match;
+    }
+}
+
+/* Log */
+
+// Below this many free segments the compactor thread starts: a quarter of
+// the spare segments, the others are left to gather stale blocks
+static int low_water(struct swap *s)
+{
+    return 2 + (s->nsegments - s->npages / SEGMENT_BLOCKS) / 4;
+}
+
+// Take the next block of the log, opening a free segment if the open one
+// is full. The last free segment is kept for compaction, and for writes when
+// there is nothing left to compact, "reserve" set. Returns -1 if there is none.
+static int log_take(struct swap *s, bool reserve)
+{
+    if (s->log_segment < 0 || s->log_next == SEGMENT_BLOCKS)
+    {
+        if ((int)s->free_segments.size() < (reserve ? 1 : 2))
+        {
+            return -1;
+        }
+        if (s->log_segment >= 0)
+        {
+            s->closed[s->log_segment] = 1;
+        }
+        s->log_segment = s->free_segments.back();
+        s->free_segments.pop_back();
+        s->log_next = 0;
+    }
+    return s->log_segment * SEGMENT_BLOCKS + s->log_next++;
+}
+
+// Make "block" the block of "page"
+static void log_assign(struct swap *s, int page, int block)
+{
+    s->slot_of[page] = block;
+    s->page_of[block] = page;
+    s->live[block / SEGMENT_BLOCKS]++;
+}
+
+// Forget the block of "page", if it has one
+static void log_release(struct swap *s, int page)
+{
+    int block = s->slot_of[page];
+    if (block >= 0)
+    {
+        s->slot_of[page] = -1;
+        s->page_of[block] = -1;
+        s->live[block / SEGMENT_BLOCKS]--;
+    }
+}
+
+// Move the live blocks of the full segment with the fewest of them, at most
+// "max_live", to the head of the log and free it, through "buffer" of a
+// segment's worth of blocks. Returns false if there is no such segment that
+// isn't being read or written. The lock is held; with "guard" it is dropped
+// for the disk I/O, otherwise the caller relies on it being held throughout.
+static bool log_compact(struct swap *s, int max_live, char *buffer, std::unique_lock<std::mutex> *guard)
+{
+    int victim = -1;
+    for (int segment = 0; segment < s->nsegments; segment++)
+    {
+        if (s->closed[segment] && s->pins[segment] == 0 && s->live[segment] <= max_live &&
+            (victim < 0 || s->live[segment] < s->live[victim]))
+        {
+            victim = segment;
+        }
+    }
+    int room = (s->log_segment < 0 ? 0 : SEGMENT_BLOCKS - s->log_next) +
+               (int)s->free_segments.size() * SEGMENT_BLOCKS;
+    if (victim < 0 || room < s->live[victim])
+    {
+        return false;
+    }
+
+    // The victim and the blocks the pages move to are pinned, so that
+    // neither is compacted meanwhile. The pages keep their old blocks until
+    // the new ones are written, faults read them from there.
+    s->closed[victim] = 0;
+    s->pins[victim]++;
+    int first = victim * SEGMENT_BLOCKS;
+    int pages[SEGMENT_BLOCKS];
+    int to[SEGMENT_BLOCKS];
+    char *data[SEGMENT_BLOCKS];
+    int lo = SEGMENT_BLOCKS, hi = -1;
+    for (int i = 0; i < SEGMENT_BLOCKS; i++)
+    {
+        data[i] = buffer + (size_t)i * BLOCK_SIZE;
+        pages[i] = s->page_of[first + i];
+        to[i] = -1;
+        if (pages[i] >= 0)
+        {
+            lo = lo < i ? lo : i;
+            hi = i;
+            to[i] = log_take(s, true);
+            s->pins[to[i] / SEGMENT_BLOCKS]++;
+        }
+    }
+    if (guard)
+    {
+        guard->unlock();
+    }
+
+    if (lo <= hi)
+    {
+        // One read for the segment, stale blocks in between and all
+        disk_readv(s->disk, first + lo, data + lo, hi - lo + 1);
+    }
+    // The live blocks go out in runs of adjacent blocks at the head
+    const char *run[SEGMENT_BLOCKS];
+    int run_first = -1, run_length = 0;
+    for (int i = lo; i <= hi; i++)
+    {
+        if (to[i] < 0)
+        {
+            continue;
+        }
+        if (run_length > 0 && to[i] != run_first + run_length)
+        {
+            disk_writev(s->disk, run_first, run, run_length);
+            run_length = 0;
+        }
+        if (run_length == 0)
+        {
+            run_first = to[i];
+        }
+        run[run_length++] = data[i];
+    }
+    if (run_length > 0)
+    {
+        disk_writev(s->disk, run_first, run, run_length);
+    }
+
+    if (guard)
+    {
+        guard->lock();
+    }
+    for (int i = lo; i <= hi; i++)
+    {
+        if (to[i] < 0)
+        {
+            continue;
+        }
+        // A page written again meanwhile left its old block, the copy is stale
+        if (s->page_of[first + i] == pages[i])
+        {
+            log_release(s, pages[i]);
+            log_assign(s, pages[i], to[i]);
+        }
+        s->pins[to[i] / SEGMENT_BLOCKS]--;
+        s->stats.compacted++;
+    }
+    if (lo <= hi)
+    {
+        s->stats.compact_reads += hi - lo + 1;
+    }
+    s->pins[victim]--;
+    s->free_segments.push_back(victim);
+    return true;
+}
+
+// Give "page" a new block at the head of the log, compacting right away if
+// there is no compactor thread or it is behind
+static int log_alloc(struct swap *s, int page)
+{
+    log_release(s, page);
+    int block = log_take(s, false);
+    while (block < 0)
+    {
+        if (!log_compact(s, SEGMENT_BLOCKS - 1, s->moving, nullptr))
+        {
+            block = log_take(s, true);
+            if (block < 0)
+            {
+                std::cerr << "swap: no free block left on the disk" << std::endl;
+                abort();
+            }
+            break;
+        }
+        block = log_take(s, false);
+    }
+    if (s->compactor && (int)s->free_segments.size() < low_water(s))
+    {
+        s->compact_wakeup.notify_one();
+    }
+    log_assign(s, page, block);
+    return block;
+}
+
+// Write "page" to a new block of the log. The lock is held, but not while
+// the block is written.
+static void log_write(struct swap *s, int page, const char *data, std::unique_lock<std::mutex> &guard)
+{
+    int block = log_alloc(s, page);
+    int segment = block / SEGMENT_BLOCKS;
+    s->pins[segment]++;
+    guard.unlock();
+    disk_write_async(s->disk, block, data);
+    guard.lock();
+    s->pins[segment]--;
+}
+
+// Compactor thread: keeps free segments above the low water mark, one
+// segment at a time, without the lock while it reads and writes, so that
+// faults go on meanwhile. It leaves the segments that are less than a
+// quarter stale, moving them would cost more writes than it wins blocks; a
+// fault that runs out of segments takes those, holding the lock.
+static void compactor(struct swap *s, char *buffer)
+{
+    std::unique_lock<std::mutex> guard(s->lock);
+    while (!s->stopping)
+    {
+        if ((int)s->free_segments.size() > low_water(s) ||
+            !log_compact(s, SEGMENT_BLOCKS * 3 / 4, buffer, &guard))
+        {
+            s->compact_wakeup.wait(guard);
+            continue;
+        }
+        guard.unlock();
+        std::this_thread::yield();
+        guard.lock();
+    }
+}
+
+/* Pool */
+
+static long record_size(int length)
+{
+    return (sizeof(struct pool_record) + length + 7) & ~7L;
+}
+
+// Free the oldest record, writing its page to the disk if it is still the
+// page's newest copy. Returns the number of blocks written.
+static int pool_drop_oldest(struct swap *s)
+{
+    long left = s->pool_size - s->head;
+    if (left < (long)sizeof(struct pool_record))
+    {
+        // Too little room for a padding record at the end
+        s->used -= left;
+        s->head = 0;
+        return 0;
+    }
+
+    struct pool_record *r = (struct pool_record *)(s->pool + s->head);
+    long size = r->page < 0 ? left : record_size(r->length);
+    int written = 0;
+    if (r->page >= 0 && s->offset_of[r->page] == s->head)
+    {
+        alignas(BLOCK_SIZE) char block[BLOCK_SIZE];
+        decompress_block((const char *)(r + 1), r->length, block);
+        // Still under the lock, so that a fault on the page that finds it
+        // gone from the pool reads it from the disk after this write
+        disk_write_async(s->disk, log_alloc(s, r->page), block);
+        s->offset_of[r->page] = -1;
+        s->stats.written_back++;
+        s->stats.pool_pages--;
+        s->stats.pool_bytes -= size;
+        written = 1;
+    }
+    s->head += size;
+    s->used -= size;
+    if (s->head == s->pool_size)
+    {
+        s->head = 0;
+    }
+    return written;
+}
+
+// Drop the record of "page" from the pool, if it has one
+static void pool_forget(struct swap *s, int page)
+{
+    if (s->pool && s->offset_of[page] >= 0)
+    {
+        struct pool_record *old = (struct pool_record *)(s->pool + s->offset_of[page]);
+        s->offset_of[page] = -1;
+        s->stats.pool_pages--;
+        s->stats.pool_bytes -= record_size(old->length);
+    }
+}
+
+// Make room for a record of "size" bytes at the tail, returns the number of
+// blocks written to the disk to get it
+static int pool_reserve(struct swap *s, long size)
+{
+    int written = 0;
+    for (;;)
+    {
+        if (s->used == 0)
+        {
+            s->head = s->tail = 0;
+        }
+        if (s->used == 0 || s->tail > s->head)
+        {
+            // Free from the tail to the end and from the start to the head
+            long left = s->pool_size - s->tail;
+            if (left >= size)
+            {
+                return written;
+            }
+            if (left >= (long)sizeof(struct pool_record))
+            {
+                struct pool_record *padding = (struct pool_record *)(s->pool + s->tail);
+                padding->page = -1;
+                padding->length = left - sizeof(struct pool_record);
+            }
+            s->used += left;
+            s->tail = 0;
+        }
+        else if (s->head - s->tail >= size)
+        {
+            return written;
+        }
+        else
+        {
+            written += pool_drop_oldest(s);
+        }
+    }
+}
+
+struct swap *swap_create(struct disk *d, int npages, long pool_bytes, bool background)
+{
+    struct swap *s = new struct swap;
+    s->disk = d;
+    s->npages = npages;
+    s->pool = 0;
+    s->pool_size = pool_bytes & ~7L;
+    s->head = s->tail = s->used = 0;
+    memset(&s->stats, 0, sizeof(s->stats));
+    // A new disk reads as zeroes
+    s->stored.assign(npages, 0);
+    s->fill_of.assign(npages, 0);
+
+    s->nsegments = disk_nblocks(d) / SEGMENT_BLOCKS;
+    s->slot_of.assign(npages, -1);
+    s->page_of.assign(s->nsegments * SEGMENT_BLOCKS, -1);
+    s->live.assign(s->nsegments, 0);
+    s->pins.assign(s->nsegments, 0);
+    s->closed.assign(s->nsegments, 0);
+    // Lowest segments first
+    for (int segment = s->nsegments - 1; segment >= 0; segment--)
+    {
+        s->free_segments.push_back(segment);
+    }
+    s->log_segment = -1;
+    s->log_next = 0;
+    s->stopping = false;
+    s->moving = (char *)aligned_alloc(BLOCK_SIZE, (size_t)SEGMENT_BLOCKS * BLOCK_SIZE);
+    s->compacting = (char *)aligned_alloc(BLOCK_SIZE, (size_t)SEGMENT_BLOCKS * BLOCK_SIZE);
+    if (!s->moving || !s->compacting)
+    {
+        free(s->moving);
+        free(s->compacting);
+        delete s;
+        return 0;
+    }
+    if (s->pool_size > 0)
+    {
+        s->pool = new (std::nothrow) char[s->pool_size];
+        if (!s->pool)
+        {
+            free(s->moving);
+            free(s->compacting);
+            delete s;
+            return 0;
+        }
+        s->offset_of.assign(npages, -1);
+    }
+    s->compactor = background ? new std::thread(compactor, s, s->compacting) : nullptr;
+    return s;
+}
+
+bool swap_page_filled(const char *data)
+{
+    uint64_t word;
+    return block_is_filled(data, &word);
+}
+
+int swap_disk_blocks(int npages)
+{
+    int spare = npages > 8 * SEGMENT_BLOCKS ? npages : 8 * SEGMENT_BLOCKS;
+    return (npages + spare + SEGMENT_BLOCKS - 1) / SEGMENT_BLOCKS * SEGMENT_BLOCKS;
+}
+
+int swap_write(struct swap *s, int page, const char *data)
+{
+    uint64_t word;
+    if (block_is_filled(data, &word))
+    {
+        std::lock_guard<std::mutex> guard(s->lock);
+        // A stale copy in the pool or on the disk is never read again
+        pool_forget(s, page);
+        log_release(s, page);
+        s->stored[page] = 0;
+        s->fill_of[page] = word;
+        s->stats.filled++;
+        return 0;
+    }
+
+    s->stored[page] = 1;
+    if (!s->pool)
+    {
+        std::unique_lock<std::mutex> guard(s->lock);
+        log_write(s, page, data, guard);
+        return 1;
+    }
+
+    char compressed[POOL_MAX_COMPRESSED];
+    int length = compress_block(data, compressed, POOL_MAX_COMPRESSED);
+    long size = record_size(length);
+
+    std::unique_lock<std::mutex> guard(s->lock);
+    // The old copy is stale either way
+    pool_forget(s, page);
+    if (length == 0 || size > s->pool_size)
+    {
+        s->stats.rejected++;
+        log_write(s, page, data, guard);
+        return 1;
+    }
+
+    log_release(s, page);
+    int written = pool_reserve(s, size);
+    struct pool_record *r = (struct pool_record *)(s->pool + s->tail);
+    r->page = page;
+    r->length = length;
+    memcpy(r + 1, compressed, length);
+    s->offset_of[page] = s->tail;
+    s->tail += size;
+    s->used += size;
+    s->stats.stored++;
+    s->stats.pool_pages++;
+    s->stats.pool_bytes += size;
+    return written;
+}
+
+int swap_writev(struct swap *s, const int *pages, const char *const *data, int count, int *written)
+{
+    if (s->pool)
+    {
+        // Each page is compressed on its own
+        int total = 0;
+        for (int i = 0; i < count; i++)
+        {
+            int w = swap_write(s, pages[i], data[i]);
+            if (written)
+            {
+                written[i] = w;
+            }
+            total += w;
+        }
+        return total;
+    }
+
+    int total = 0;
+    for (int start = 0; start < count; start += SWAP_BATCH)
+    {
+        int n = count - start < SWAP_BATCH ? count - start : SWAP_BATCH;
+        bool filled[SWAP_BATCH];
+        uint64_t words[SWAP_BATCH];
+        int blocks[SWAP_BATCH];
+        for (int i = 0; i < n; i++)
+        {
+            filled[i] = block_is_filled(data[start + i], &words[i]);
+        }
+
+        // The pages get adjacent blocks at the head of the log, each one
+        // pinned before the next may compact
+        std::unique_lock<std::mutex> guard(s->lock);
+        for (int i = 0; i < n; i++)
+        {
+            int page = pages[start + i];
+            blocks[i] = -1;
+            if (filled[i])
+            {
+                log_release(s, page);
+                s->stored[page] = 0;
+                s->fill_of[page] = words[i];
+                s->stats.filled++;
+            }
+            else
+            {
+                s->stored[page] = 1;
+                blocks[i] = log_alloc(s, page);
+                s->pins[blocks[i] / SEGMENT_BLOCKS]++;
+                total++;
+            }
+            if (written)
+            {
+                written[start + i] = blocks[i] >= 0;
+            }
+        }
+        guard.unlock();
+
+        int i = 0;
+        while (i < n)
+        {
+            if (blocks[i] < 0)
+            {
+                i++;
+                continue;
+            }
+            int run = 1;
+            while (i + run < n && blocks[i + run] == blocks[i] + run)
+            {
+                run++;
+            }
+            disk_writev(s->disk, blocks[i], data + start + i, run);
+            i += run;
+        }
+
+        guard.lock();
+        for (int i = 0; i < n; i++)
+        {
+            if (blocks[i] >= 0)
+            {
+                s->pins[blocks[i] / SEGMENT_BLOCKS]--;
+            }
+        }
+    }
+    return total;
+}
+
+int swap_read(struct swap *s, int page, char *data)
+{
+    return swap_readv(s, &page, &data, 1, nullptr);
+}
+
+int swap_readv(struct swap *s, const int *pages, char *const *data, int count, int *read)
+{
+    int total = 0;
+    for (int start = 0; start < count; start += SWAP_BATCH)
+    {
+        int n = count - start < SWAP_BATCH ? count - start : SWAP_BATCH;
+        int blocks[SWAP_BATCH];
+
+        std::unique_lock<std::mutex> guard(s->lock);
+        for (int i = 0; i < n; i++)
+        {
+            int page = pages[start + i];
+            blocks[i] = -1;
+            if (!s->stored[page])
+            {
+                fill_block(data[start + i], s->fill_of[page]);
+                s->stats.filled_reads++;
+            }
+            else if (s->pool && s->offset_of[page] >= 0)
+            {
+                struct pool_record *r = (struct pool_record *)(s->pool + s->offset_of[page]);
+                decompress_block((const char *)(r + 1), r->length, data[start + i]);
+                s->stats.pool_reads++;
+            }
+            else
+            {
+                // The segment can't be compacted and reused while it is read
+                blocks[i] = s->slot_of[page];
+                s->pins[blocks[i] / SEGMENT_BLOCKS]++;
+                total++;
+            }
+            if (read)
+            {
+                read[start + i] = blocks[i] >= 0;
+            }
+        }
+        guard.unlock();
+
+        // Pages that were evicted together are read back with one preadv
+        int i = 0;
+        while (i < n)
+        {
+            if (blocks[i] < 0)
+            {
+                i++;
+                continue;
+            }
+            int run = 1;
+            while (i + run < n && blocks[i + run] == blocks[i] + run)
+            {
+                run++;
+            }
+            disk_readv(s->disk, blocks[i], data + start + i, run);
+            i += run;
+        }
+
+        guard.lock();
+        for (int i = 0; i < n; i++)
+        {
+            if (blocks[i] >= 0)
+            {
+                s->pins[blocks[i] / SEGMENT_BLOCKS]--;
+            }
+        }
+    }
+    return total;
+}
+
+struct swap_stats swap_get_stats(struct swap *s)
+{
+    std::lock_guard<std::mutex> guard(s->lock);
+    return s->stats;
+}
+
+void swap_delete(struct swap *s)
+{
+    {
+        std::lock_guard<std::mutex> guard(s->lock);
+        s->stopping = true;
+    }
+    s->compact_wakeup.notify_one();
+    if (s->compactor)
+    {
+        s->compactor->join();
+        delete s->compactor;
+    }
+    delete[] s->pool;
+    free(s->moving);
+    free(s->compacting);
+    delete s;
+}
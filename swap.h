@@ -0,0 +1,126 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+/*
+The swap of an address space: where evicted pages go and where faults read
+them back from. It sits between the fault handler and the virtual disk.
+
+The disk is a log: a page is written to the next free block at its head,
+wherever the page was before, so pages evicted together land next to each
+other and the writes are sequential, and adjacent queued writes go out in
+one pwritev. Blocks are handed out a segment of 32 at a time. The blocks
+that pages leave behind go stale. Compaction moves the live blocks out of
+the segments with the fewest of them to free those segments for the log
+again. By default a write that finds the log short of free segments
+compacts one, so a run compacts at the same points every time. Optionally
+a compactor thread keeps segments free in the background, reading and
+writing without holding up faults, but when it runs then depends on
+timing. The disk gets as many spare blocks as pages, so that a segment is
+mostly stale by the time it is compacted; swap_disk_blocks tells how many
+blocks to give it. Compaction I/O is counted in swap_stats, apart from the
+blocks that swap_write and swap_read report.
+
+A page that is one 8 byte word repeated, zeroes most of all, is not stored
+anywhere: the swap keeps the word and fills the page with it when it is
+read back. Pages that were never written read as zeroes the same way, so
+neither kind of page ever costs a disk access.
+
+With a compressed pool (zswap), an evicted page is compressed and kept in
+RAM instead, if it shrinks to at most 3/4 of a page. The pool is a log in a
+preallocated arena: compressed pages are appended, and when the arena is
+full the oldest ones are decompressed and written to the disk to make room.
+A page read back from the pool stays there too, so that it costs nothing
+to evict again while it is clean. No memory is allocated after swap_create.
+
+The codec is a small LZ77 in the style of LZ4 blocks (literal runs and
+matches of at least 4 bytes within the page), fast enough for the fault
+path and good at the repeating patterns the test programs write.
+
+Functions that take a page must be called with that page locked, so that
+the swap never sees two operations on one page at once.
+*/
+
+struct disk;
+
+/*
+The size of the disk for a swap of "npages" pages, in blocks.
+*/
+
+int swap_disk_blocks(int npages);
+
+/*
+Check if "data", a page, is one 8 byte word repeated, which swap_write keeps
+without the disk or the pool.
+*/
+
+bool swap_page_filled(const char *data);
+
+/*
+Create the swap of "npages" pages on disk "d", which has swap_disk_blocks
+blocks for them, with a compressed pool of "pool_bytes" bytes, 0 for none,
+and a compactor thread if "background" is set. Returns null if
+there is no memory for it.
+*/
+
+struct swap *swap_create(struct disk *d, int npages, long pool_bytes, bool background);
+
+/*
+Store a page. Returns how many blocks were written to the disk for it: 0 if
+it was same-filled or went to the pool without pushing anything out, 1 or
+more otherwise.
+*/
+
+int swap_write(struct swap *s, int page, const char *data);
+
+/*
+Load a page. Returns how many blocks were read from the disk: 0 if it was
+same-filled, never written or in the pool, 1 otherwise.
+*/
+
+int swap_read(struct swap *s, int page, char *data);
+
+/*
+Store "count" pages at once, pages[i] from data[i]. Without a pool they get
+adjacent blocks of the log and go to the disk with one pwritev. If
+"written" is not null, written[i] is set to what swap_write would have
+returned for pages[i]. Returns the number of blocks written.
+*/
+
+int swap_writev(struct swap *s, const int *pages, const char *const *data, int count, int *written);
+
+/*
+Load "count" pages at once, pages[i] into data[i]. The ones that sit in
+adjacent blocks, as pages evicted together do, are read with one preadv.
+If "read" is not null, read[i] is set to what swap_read would have returned
+for pages[i]. Returns the number of blocks read.
+*/
+
+int swap_readv(struct swap *s, const int *pages, char *const *data, int count, int *read);
+
+/*
+What the swap did so far.
+*/
+
+struct swap_stats
+{
+    long stored;        // pages compressed into the pool
+    long rejected;      // pages that didn't compress enough and went to disk
+    long pool_reads;    // faults served from the pool
+    long written_back;  // pages pushed out of the pool to the disk
+    long pool_pages;    // pages in the pool now
+    long pool_bytes;    // bytes of the arena they take now, with their headers
+    long filled;        // pages stored as a single repeated word
+    long filled_reads;  // faults served by filling a page with its word
+    long compacted;     // blocks compaction wrote to the head of the log
+    long compact_reads; // blocks it read to move them, stale ones in between included
+};
+
+struct swap_stats swap_get_stats(struct swap *s);
+
+/*
+Free the swap. Pages still in the pool are lost, the disk is not touched.
+*/
+
+void swap_delete(struct swap *s);
+
+#endif
@@ -0,0 +1,120 @@
+#include "trace.h"
+
+#include <fstream>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+struct trace
+{
+    int npages;
+    long length;
+    int last_page;
+    std::vector<unsigned char> data; // encoded references
+};
+
+struct trace *trace_create(int npages)
+{
+    struct trace *t = new struct trace;
+    t->npages = npages;
+    t->length = 0;
+    t->last_page = 0;
+    return t;
+}
+
+long trace_append(struct trace *t, int page, int flags)
+{
+    long position = t->data.size();
+    long delta = (long)page - t->last_page;
+    unsigned long zigzag = ((unsigned long)delta << 1) ^ (unsigned long)(delta >> 63);
+    unsigned long value = zigzag << 3 | (flags & 7);
+    while (value >= 0x80)
+    {
+        t->data.push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    t->data.push_back(value);
+    t->last_page = page;
+    t->length++;
+    return position;
+}
+
+void trace_add_flags(struct trace *t, long position, int flags)
+{
+    // The flags are the low bits of the first byte
+    t->data[position] |= flags & 7;
+}
+
+int trace_save(struct trace *t, const char *filename)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        return 0;
+    }
+    uint32_t npages = t->npages;
+    uint64_t length = t->length;
+    file.write("VMTRACE2", 8);
+    file.write((const char *)&npages, sizeof(npages));
+    file.write((const char *)&length, sizeof(length));
+    file.write((const char *)t->data.data(), t->data.size());
+    return file.good();
+}
+
+struct trace *trace_load(const char *filename)
+{
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        return 0;
+    }
+    long size = file.tellg();
+    file.seekg(0);
+
+    char magic[8];
+    uint32_t npages;
+    uint64_t length;
+    file.read(magic, sizeof(magic));
+    file.read((char *)&npages, sizeof(npages));
+    file.read((char *)&length, sizeof(length));
+    long header = sizeof(magic) + sizeof(npages) + sizeof(length);
+    if (!file.good() || memcmp(magic, "VMTRACE2", sizeof(magic)) != 0 || size < header)
+    {
+        return 0;
+    }
+
+    struct trace *t = trace_create(npages);
+    t->length = length;
+    t->data.resize(size - header);
+    file.read((char *)t->data.data(), t->data.size());
+    if (!file.good())
+    {
+        trace_delete(t);
+        return 0;
+    }
+    return t;
+}
+
+int trace_npages(struct trace *t)
+{
+    return t->npages;
+}
+
+long trace_length(struct trace *t)
+{
+    return t->length;
+}
+
+struct trace_cursor trace_begin(struct trace *t)
+{
+    struct trace_cursor c;
+    c.pos = t->data.data();
+    c.end = c.pos + t->data.size();
+    c.page = 0;
+    return c;
+}
+
+void trace_delete(struct trace *t)
+{
+    delete t;
+}
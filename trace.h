@@ -0,0 +1,127 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+A page reference trace: the pages a program touched, in order, each marked
+as a read or a write. Consecutive references to the same page that can never
+fault are left out, so a trace holds exactly the references that decide the
+faults of a run with any policy and at least two frames. A reference marked
+TRACE_STRADDLE is the read of a page by an access that also needs the page
+of the previous read, so both must be resident at once. A write marked
+TRACE_FILLED left its page one 8 byte word repeated, zeroes above all, by
+the time the program moved on to another page. Until the page is written
+again, that is how the swap finds it whenever it is evicted, and the swap
+keeps such a page as a single word without the disk (see swap.h).
+
+A trace file starts with "VMTRACE2", the number of pages (uint32) and the
+number of references (uint64), in the byte order of the machine that wrote
+it. Each reference follows as an unsigned LEB128 varint of
+zigzag(page - previous page) * 8 + flags, the first one relative to page 0.
+Programs mostly move to a nearby page, so most references take one byte.
+
+A trace holds no contents of pages beyond TRACE_FILLED. Replaying one
+counts a disk write for every dirty page evicted that isn't same-filled,
+and a read for every fault on a page that went to the disk, as the swap
+does. So a replay gives the page faults, disk writes and disk reads of a
+live run of the program with the same policy, frames and seed, without the
+options that load, clean or store pages differently (fault-around,
+read-ahead, writeback, eviction clusters, merging, the compressed pool);
+"make check" compares the two for every program and policy. The compaction
+of the swap's log is left out of both, a live run reports it apart from its
+disk totals.
+*/
+
+#define TRACE_WRITE 1
+#define TRACE_STRADDLE 2
+#define TRACE_FILLED 4
+
+/*
+Create an empty trace of a virtual memory of "npages" pages.
+*/
+
+struct trace *trace_create(int npages);
+
+/*
+Append a reference to "page", with "flags" a combination of TRACE_WRITE and
+TRACE_STRADDLE (0 for a read). Returns its position, for trace_add_flags.
+*/
+
+long trace_append(struct trace *t, int page, int flags);
+
+/*
+Add "flags" to the reference at "position". TRACE_FILLED is only known once
+the program has moved on from the page, after the reference was appended.
+*/
+
+void trace_add_flags(struct trace *t, long position, int flags);
+
+/*
+Write the trace to the file "filename". Returns 0 on failure.
+*/
+
+int trace_save(struct trace *t, const char *filename);
+
+/*
+Read a trace from the file "filename".
+Returns null if it can't be read or is not a trace.
+*/
+
+struct trace *trace_load(const char *filename);
+
+/*
+Return the number of pages and the number of references of the trace.
+*/
+
+int trace_npages(struct trace *t);
+long trace_length(struct trace *t);
+
+/*
+Position in a trace, from trace_begin. Decoding is inline, so a replay loop
+costs a few instructions per reference.
+*/
+
+struct trace_cursor
+{
+    const unsigned char *pos;
+    const unsigned char *end;
+    int page;
+};
+
+struct trace_cursor trace_begin(struct trace *t);
+
+/*
+Decode the next reference into "page" and "flags".
+Returns 0 at the end of the trace.
+*/
+
+static inline int trace_next(struct trace_cursor *c, int *page, int *flags)
+{
+    if (c->pos == c->end)
+    {
+        return 0;
+    }
+    unsigned long value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do
+    {
+        byte = *c->pos++;
+        value |= (unsigned long)(byte & 0x7f) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && c->pos != c->end);
+
+    unsigned long zigzag = value >> 3;
+    long delta = (long)(zigzag >> 1) ^ -(long)(zigzag & 1);
+    c->page += delta;
+    *page = c->page;
+    *flags = value & 7;
+    return 1;
+}
+
+/*
+Free the trace.
+*/
+
+void trace_delete(struct trace *t);
+
+#endif